@@ -17,14 +17,21 @@
 #include "types.h"
 #include "param.h"
 #include "spinlock.h"
+#include "rwlock.h"
 #include "sleeplock.h"
 #include "riscv.h"
 #include "defs.h"
 #include "fs.h"
 #include "buf.h"
+#include "rusage.h"
+#include "proc.h"
 
+// bcache.lock is held for reading to look a block up or to
+// drop a reference, and for writing to recycle a buffer or
+// reorder the list.  Readers change refcnt only with atomic
+// operations, and never drop it to 0.
 struct {
-  struct spinlock lock;
+  struct rwlock lock;
   struct buf buf[NBUF];
 
   // Linked list of all buffers, through prev/next.
@@ -38,7 +45,7 @@ binit(void)
 {
   struct buf *b;
 
-  initlock(&bcache.lock, "bcache");
+  initrwlock(&bcache.lock, "bcache");
 
   // Create linked list of buffers
   bcache.head.prev = &bcache.head;
@@ -52,6 +59,23 @@ binit(void)
   }
 }
 
+// Find the cached buffer for block blockno on device dev and
+// take a reference to it, or return 0.
+// Caller holds bcache.lock, for reading or writing.
+static struct buf*
+bfind(uint dev, uint blockno)
+{
+  struct buf *b;
+
+  for(b = bcache.head.next; b != &bcache.head; b = b->next){
+    if(b->dev == dev && b->blockno == blockno){
+      __sync_fetch_and_add(&b->refcnt, 1);
+      return b;
+    }
+  }
+  return 0;
+}
+
 // Look through buffer cache for block on device dev.
 // If not found, allocate a buffer.
 // In either case, return locked buffer.
@@ -60,19 +84,24 @@ bget(uint dev, uint blockno)
 {
   struct buf *b;
 
-  acquire(&bcache.lock);
-
   // Is the block already cached?
-  for(b = bcache.head.next; b != &bcache.head; b = b->next){
-    if(b->dev == dev && b->blockno == blockno){
-      b->refcnt++;
-      release(&bcache.lock);
-      acquiresleep(&b->lock);
-      return b;
-    }
+  acquireread(&bcache.lock);
+  b = bfind(dev, blockno);
+  releaseread(&bcache.lock);
+  if(b){
+    acquiresleep(&b->lock);
+    return b;
+  }
+
+  // Not cached.  Look again as a writer, in case another
+  // process brought it in meanwhile.
+  acquirewrite(&bcache.lock);
+  if((b = bfind(dev, blockno)) != 0){
+    releasewrite(&bcache.lock);
+    acquiresleep(&b->lock);
+    return b;
   }
 
-  // Not cached.
   // Recycle the least recently used (LRU) unused buffer.
   for(b = bcache.head.prev; b != &bcache.head; b = b->prev){
     if(b->refcnt == 0) {
@@ -80,7 +109,7 @@ bget(uint dev, uint blockno)
       b->blockno = blockno;
       b->valid = 0;
       b->refcnt = 1;
-      release(&bcache.lock);
+      releasewrite(&bcache.lock);
       acquiresleep(&b->lock);
       return b;
     }
@@ -88,20 +117,38 @@ bget(uint dev, uint blockno)
   panic("bget: no buffers");
 }
 
-// Return a locked buf with the contents of the indicated block.
+// Return a locked buf with the contents of the indicated block,
+// charging a disk read to the calling process's ru_inblock.
 struct buf*
 bread(uint dev, uint blockno)
 {
+  struct proc *p;
   struct buf *b;
 
   b = bget(dev, blockno);
   if(!b->valid) {
     virtio_disk_rw(b, 0);
     b->valid = 1;
+    if((p = myproc()) != 0)
+      p->ru.ru_inblock++;
   }
   return b;
 }
 
+// Return a locked buf for the indicated block, zeroed
+// instead of read from disk, for a caller that is about
+// to overwrite the block's contents.
+struct buf*
+bnew(uint dev, uint blockno)
+{
+  struct buf *b;
+
+  b = bget(dev, blockno);
+  memset(b->data, 0, BSIZE);
+  b->valid = 1;
+  return b;
+}
+
 // Write b's contents to disk.  Must be locked.
 void
 bwrite(struct buf *b)
@@ -111,17 +158,24 @@ bwrite(struct buf *b)
   virtio_disk_rw(b, 1);
 }
 
-// Release a locked buffer.
-// Move to the head of the most-recently-used list.
-void
-brelse(struct buf *b)
+// Drop a reference to b.  Only the last one needs the lock
+// for writing, to move b to the head of the most-recently-used
+// list.
+static void
+bput(struct buf *b)
 {
-  if(!holdingsleep(&b->lock))
-    panic("brelse");
+  uint r;
 
-  releasesleep(&b->lock);
+  acquireread(&bcache.lock);
+  while((r = __atomic_load_n(&b->refcnt, __ATOMIC_RELAXED)) > 1){
+    if(__sync_bool_compare_and_swap(&b->refcnt, r, r - 1)){
+      releaseread(&bcache.lock);
+      return;
+    }
+  }
+  releaseread(&bcache.lock);
 
-  acquire(&bcache.lock);
+  acquirewrite(&bcache.lock);
   b->refcnt--;
   if (b->refcnt == 0) {
     // no one is waiting for it.
@@ -132,22 +186,31 @@ brelse(struct buf *b)
     bcache.head.next->prev = b;
     bcache.head.next = b;
   }
-  
-  release(&bcache.lock);
+  releasewrite(&bcache.lock);
+}
+
+// Release a locked buffer.
+// Move to the head of the most-recently-used list.
+void
+brelse(struct buf *b)
+{
+  if(!holdingsleep(&b->lock))
+    panic("brelse");
+
+  releasesleep(&b->lock);
+  bput(b);
 }
 
 void
 bpin(struct buf *b) {
-  acquire(&bcache.lock);
-  b->refcnt++;
-  release(&bcache.lock);
+  acquireread(&bcache.lock);
+  __sync_fetch_and_add(&b->refcnt, 1);
+  releaseread(&bcache.lock);
 }
 
 void
 bunpin(struct buf *b) {
-  acquire(&bcache.lock);
-  b->refcnt--;
-  release(&bcache.lock);
+  bput(b);
 }
 
 
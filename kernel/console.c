@@ -16,10 +16,12 @@
 #include "spinlock.h"
 #include "sleeplock.h"
 #include "fs.h"
+#include "rcu.h"
 #include "file.h"
 #include "memlayout.h"
 #include "riscv.h"
 #include "defs.h"
+#include "rusage.h"
 #include "proc.h"
 
 #define BACKSPACE 0x100
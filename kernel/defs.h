@@ -2,16 +2,22 @@ struct buf;
 struct context;
 struct file;
 struct inode;
+struct kcache;
+struct iovec;
+struct pcpage;
 struct pipe;
 struct proc;
 struct spinlock;
 struct sleeplock;
+struct rwlock;
+struct rcuhead;
 struct stat;
 struct superblock;
 
 // bio.c
 void            binit(void);
 struct buf*     bread(uint, uint);
+struct buf*     bnew(uint, uint);
 void            brelse(struct buf*);
 void            bwrite(struct buf*);
 void            bpin(struct buf*);
@@ -31,8 +37,10 @@ void            fileclose(struct file*);
 struct file*    filedup(struct file*);
 void            fileinit(void);
 int             fileread(struct file*, uint64, int n);
+int             filereadv(struct file*, struct iovec*, int, int);
 int             filestat(struct file*, uint64 addr);
 int             filewrite(struct file*, uint64, int n);
+int             filewritev(struct file*, struct iovec*, int, int);
 
 // fs.c
 void            fsinit(int);
@@ -53,6 +61,12 @@ int             readi(struct inode*, int, uint64, uint, uint);
 void            stati(struct inode*, struct stat*);
 int             writei(struct inode*, int, uint64, uint, uint);
 void            itrunc(struct inode*);
+char*           igetpage(struct inode*, uint);
+
+// futex.c
+void            futexinit(void);
+int             futexwait(uint64, int);
+int             futexwake(uint64, int);
 
 // ramdisk.c
 void            ramdiskinit(void);
@@ -62,6 +76,11 @@ void            ramdiskrw(struct buf*);
 // kalloc.c
 void*           kalloc(void);
 void            kfree(void *);
+void*           kalloc_order(int);
+void            kfree_order(void *, int);
+void*           kzalloc(void);
+int             kzidle(void);
+int             statsbuddy(char*, int);
 void            kinit(void);
 void            kpageinc(void *);
 int             kpagecnt(void *);
@@ -69,10 +88,23 @@ void            kpagedec(void *);
 // log.c
 void            initlog(int, struct superblock*);
 void            log_write(struct buf*);
+void            log_write_data(struct buf*);
+void            log_bfree(uint);
+int             log_bfreed(uint);
 void            begin_op(void);
 void            end_op(void);
 
+// pcache.c
+void            pcacheinit(void);
+struct pcpage*  pget(uint, uint, uint);
+struct pcpage*  plookup(uint, uint, uint);
+void            pput(struct pcpage*);
+int             pcacheprivate(struct pcpage*);
+void            pcacheinval(uint, uint);
+int             pcacheshrink(void);
+
 // pipe.c
+void            pipeinit(void);
 int             pipealloc(struct file**, struct file**);
 void            pipeclose(struct pipe*, int);
 int             piperead(struct pipe*, uint64, int);
@@ -87,8 +119,12 @@ void            printfinit(void);
 int             cpuid(void);
 void            exit(int);
 int             fork(void);
-int             growproc(int);
-void            proc_mapstacks(pagetable_t);
+uint64          growproc(int);
+int             clone(uint64, uint64, uint64);
+int             join(int, uint64);
+int             getrusage(int, uint64);
+void            mmunmap(struct proc*, uint64, uint64);
+void            tlbsync(struct proc*);
 pagetable_t     proc_pagetable(struct proc *);
 void            proc_freepagetable(pagetable_t, uint64);
 int             kill(int);
@@ -104,7 +140,11 @@ void            sleep(void*, struct spinlock*);
 void            userinit(void);
 int             wait(uint64);
 void            wakeup(void*);
+void            wakeone(void*);
+int             wakeupn(void*, int);
+int             nice(int);
 void            yield(void);
+void            preempt(void);
 int             either_copyout(int user_dst, uint64 dst, void *src, uint64 len);
 int             either_copyin(void *dst, int user_src, uint64 src, uint64 len);
 void            procdump(void);
@@ -116,9 +156,40 @@ void            swtch(struct context*, struct context*);
 void            acquire(struct spinlock*);
 int             holding(struct spinlock*);
 void            initlock(struct spinlock*, char*);
+void            initticketlock(struct spinlock*, char*);
+void            freelock(struct spinlock*);
 void            release(struct spinlock*);
 void            push_off(void);
 void            pop_off(void);
+int             statslock(char*, int);
+
+// sprintf.c
+int             snprintf(char*, int, char*, ...);
+
+// stats.c
+void            statsinit(void);
+
+// rcu.c
+void            rcuinit(void);
+void            rcu_read_lock(void);
+void            rcu_read_unlock(void);
+void            call_rcu(struct rcuhead*, void (*)(struct rcuhead*));
+void            rcu_quiesce(void);
+void            rcu_idle(void);
+
+// rwlock.c
+void            initrwlock(struct rwlock*, char*);
+void            acquireread(struct rwlock*);
+void            releaseread(struct rwlock*);
+void            acquirewrite(struct rwlock*);
+void            releasewrite(struct rwlock*);
+
+// slab.c
+void            kcacheinit(struct kcache*, char*, uint);
+void*           kcachealloc(struct kcache*);
+void            kcachefree(struct kcache*, void*);
+int             kcachereclaim(void);
+int             statsslab(char*, int);
 
 // sleeplock.c
 void            acquiresleep(struct sleeplock*);
@@ -150,6 +221,14 @@ void            trapinithart(void);
 extern struct spinlock tickslock;
 void            usertrapret(void);
 
+// timer.c
+void            clockintr(void);
+void            settimer(void);
+void            timerby(uint64);
+int             sleepticks(int);
+int             sleepuntil(uint64);
+uint            uptime(void);
+
 // uart.c
 void            uartinit(void);
 void            uartintr(void);
@@ -166,16 +245,28 @@ pagetable_t     uvmcreate(void);
 void            uvmfirst(pagetable_t, uchar *, uint);
 uint64          uvmalloc(pagetable_t, uint64, uint64, int);
 uint64          uvmdealloc(pagetable_t, uint64, uint64);
-int             uvmcopy(pagetable_t, pagetable_t, uint64);
+int             uvmcopy(pagetable_t, pagetable_t, uint64, int);
+int             uvmunshare(pagetable_t, uint64, uint64);
 void            uvmfree(pagetable_t, uint64);
 void            uvmunmap(pagetable_t, uint64, uint64, int);
 void            uvmclear(pagetable_t, uint64);
+int             uvmshare(pagetable_t, uint64, uint64);
+uint64          uvmdonate(pagetable_t, uint64);
 pte_t *         walk(pagetable_t, uint64, int);
 uint64          walkaddr(pagetable_t, uint64);
 int             copyout(pagetable_t, uint64, char *, uint64);
 int             copyin(pagetable_t, char *, uint64, uint64);
 int             copyinstr(pagetable_t, char *, uint64, uint64);
 
+// vma.c
+uint64          mmap(uint64, int, int, struct file*, uint);
+int             munmap(uint64, uint64);
+int             mmapfault(uint64, int);
+void            mmapprefault(uint64, uint64);
+uint64          mmapbase(struct proc*);
+void            munmapall(struct proc*);
+int             mmapcopy(struct proc*, struct proc*);
+
 // plic.c
 void            plicinit(void);
 void            plicinithart(void);
@@ -3,6 +3,8 @@
 #include "memlayout.h"
 #include "riscv.h"
 #include "spinlock.h"
+#include "sleeplock.h"
+#include "rusage.h"
 #include "proc.h"
 #include "defs.h"
 #include "elf.h"
@@ -31,6 +33,10 @@ exec(char *path, char **argv)
   pagetable_t pagetable = 0, oldpagetable;
   struct proc *p = myproc();
 
+  // the other threads would lose their address space.
+  if(p->mm != &p->ownmm || p->mm->nthread > 0)
+    return -1;
+
   begin_op();
 
   if((ip = namei(path)) == 0){
@@ -73,7 +79,7 @@ exec(char *path, char **argv)
   ip = 0;
 
   p = myproc();
-  uint64 oldsz = p->sz;
+  uint64 oldsz = p->mm->sz;
 
   // Allocate some pages at the next page boundary.
   // Make the first inaccessible as a stack guard.
@@ -121,9 +127,10 @@ exec(char *path, char **argv)
   safestrcpy(p->name, last, sizeof(p->name));
     
   // Commit to the user image.
+  munmapall(p);
   oldpagetable = p->pagetable;
   p->pagetable = pagetable;
-  p->sz = sz;
+  p->mm->sz = sz;
   p->trapframe->epc = elf.entry;  // initial program counter = main
   p->trapframe->sp = sp; // initial stack pointer
   proc_freepagetable(oldpagetable, oldsz);
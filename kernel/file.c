@@ -9,20 +9,33 @@
 #include "fs.h"
 #include "spinlock.h"
 #include "sleeplock.h"
+#include "rcu.h"
 #include "file.h"
+#include "slab.h"
 #include "stat.h"
+#include "rusage.h"
 #include "proc.h"
+#include "uio.h"
+
+#if 1 + 1 + (FSSIZE/BPB + 1) > MAXOPBLOCKS
+#error "a write may log more than MAXOPBLOCKS blocks"
+#endif
 
 struct devsw devsw[NDEV];
+
+// File structures come from ftable.cache as they're needed,
+// up to NFILE at a time.  ftable.lock protects their ref counts.
 struct {
   struct spinlock lock;
-  struct file file[NFILE];
+  struct kcache cache;
+  int nfile;       // allocated
 } ftable;
 
 void
 fileinit(void)
 {
   initlock(&ftable.lock, "ftable");
+  kcacheinit(&ftable.cache, "file", sizeof(struct file));
 }
 
 // Allocate a file structure.
@@ -32,15 +45,22 @@ filealloc(void)
   struct file *f;
 
   acquire(&ftable.lock);
-  for(f = ftable.file; f < ftable.file + NFILE; f++){
-    if(f->ref == 0){
-      f->ref = 1;
-      release(&ftable.lock);
-      return f;
-    }
+  if(ftable.nfile >= NFILE){
+    release(&ftable.lock);
+    return 0;
   }
+  ftable.nfile++;
   release(&ftable.lock);
-  return 0;
+
+  if((f = kcachealloc(&ftable.cache)) == 0){
+    acquire(&ftable.lock);
+    ftable.nfile--;
+    release(&ftable.lock);
+    return 0;
+  }
+  memset(f, 0, sizeof(*f));
+  f->ref = 1;
+  return f;
 }
 
 // Increment ref count for file f.
@@ -69,9 +89,9 @@ fileclose(struct file *f)
     return;
   }
   ff = *f;
-  f->ref = 0;
-  f->type = FD_NONE;
+  ftable.nfile--;
   release(&ftable.lock);
+  kcachefree(&ftable.cache, f);
 
   if(ff.type == FD_PIPE){
     pipeclose(ff.pipe, ff.writable);
@@ -106,27 +126,63 @@ filestat(struct file *f, uint64 addr)
 int
 fileread(struct file *f, uint64 addr, int n)
 {
-  int r = 0;
+  struct iovec iov;
+
+  iov.iov_base = (void*)addr;
+  iov.iov_len = n;
+  return filereadv(f, &iov, 1, -1);
+}
+
+// Read from file f into the user buffers iov[0..iovcnt-1] in turn.
+// Reads an inode at offset off, or at f->off if off is -1, in which
+// case f->off is advanced; the inode stays locked throughout.
+// Reads a pipe or device into just the first non-empty buffer.
+// Returns the number of bytes read, or -1.
+int
+filereadv(struct file *f, struct iovec *iov, int iovcnt, int off)
+{
+  int i, n, r = 0, tot = 0;
+  uint o;
 
   if(f->readable == 0)
     return -1;
+  if(off != -1 && f->type != FD_INODE)
+    return -1;
 
-  if(f->type == FD_PIPE){
-    r = piperead(f->pipe, addr, n);
-  } else if(f->type == FD_DEVICE){
-    if(f->major < 0 || f->major >= NDEV || !devsw[f->major].read)
-      return -1;
-    r = devsw[f->major].read(1, addr, n);
-  } else if(f->type == FD_INODE){
+  if(f->type == FD_INODE){
     ilock(f->ip);
-    if((r = readi(f->ip, 1, addr, f->off, n)) > 0)
-      f->off += r;
+    o = (off == -1 ? f->off : off);
+    for(i = 0; i < iovcnt; i++){
+      n = iov[i].iov_len;
+      if((r = readi(f->ip, 1, (uint64)iov[i].iov_base, o, n)) < 0)
+        break;
+      tot += r;
+      o += r;
+      if(r < n)
+        break;
+    }
+    if(off == -1)
+      f->off = o;
     iunlock(f->ip);
-  } else {
-    panic("fileread");
+    return (r < 0 && tot == 0) ? -1 : tot;
   }
 
-  return r;
+  for(i = 0; i < iovcnt; i++){
+    n = iov[i].iov_len;
+    if(n == 0)
+      continue;
+    if(f->type == FD_PIPE){
+      r = piperead(f->pipe, (uint64)iov[i].iov_base, n);
+    } else if(f->type == FD_DEVICE){
+      if(f->major < 0 || f->major >= NDEV || !devsw[f->major].read)
+        return -1;
+      r = devsw[f->major].read(1, (uint64)iov[i].iov_base, n);
+    } else {
+      panic("fileread");
+    }
+    return r;
+  }
+  return 0;
 }
 
 // Write to file f.
@@ -134,49 +190,72 @@ fileread(struct file *f, uint64 addr, int n)
 int
 filewrite(struct file *f, uint64 addr, int n)
 {
-  int r, ret = 0;
+  struct iovec iov;
+
+  iov.iov_base = (void*)addr;
+  iov.iov_len = n;
+  return filewritev(f, &iov, 1, -1);
+}
+
+// Write the user buffers iov[0..iovcnt-1] to file f in turn.
+// Writes an inode at offset off, or at f->off if off is -1, in
+// which case f->off is advanced; the inode stays locked throughout.
+// Returns the number of bytes written, or -1 if it couldn't
+// write them all.
+int
+filewritev(struct file *f, struct iovec *iov, int iovcnt, int off)
+{
+  int i, n, r, tot = 0;
+  uint o;
 
   if(f->writable == 0)
     return -1;
+  if(off != -1 && f->type != FD_INODE)
+    return -1;
 
-  if(f->type == FD_PIPE){
-    ret = pipewrite(f->pipe, addr, n);
-  } else if(f->type == FD_DEVICE){
-    if(f->major < 0 || f->major >= NDEV || !devsw[f->major].write)
-      return -1;
-    ret = devsw[f->major].write(1, addr, n);
-  } else if(f->type == FD_INODE){
-    // write a few blocks at a time to avoid exceeding
-    // the maximum log transaction size, including
-    // i-node, indirect block, allocation blocks,
-    // and 2 blocks of slop for non-aligned writes.
-    // this really belongs lower down, since writei()
-    // might be writing a device like the console.
-    int max = ((MAXOPBLOCKS-1-1-2) / 2) * BSIZE;
-    int i = 0;
-    while(i < n){
-      int n1 = n - i;
-      if(n1 > max)
-        n1 = max;
-
-      begin_op();
-      ilock(f->ip);
-      if ((r = writei(f->ip, 1, addr + i, f->off, n1)) > 0)
-        f->off += r;
-      iunlock(f->ip);
-      end_op();
-
-      if(r != n1){
+  if(f->type == FD_INODE){
+    // file data doesn't go through the log (see log_write_data()),
+    // so however big the write, the transaction logs only the
+    // i-node, the indirect block, and free bitmap blocks, and
+    // the whole write can be one transaction.
+    begin_op();
+    ilock(f->ip);
+    o = (off == -1 ? f->off : off);
+    for(i = 0; i < iovcnt; i++){
+      n = iov[i].iov_len;
+      if((r = writei(f->ip, 1, (uint64)iov[i].iov_base, o, n)) > 0)
+        o += r;
+      if(r != n){
         // error from writei
+        tot = -1;
         break;
       }
-      i += r;
+      tot += r;
     }
-    ret = (i == n ? n : -1);
-  } else {
-    panic("filewrite");
+    if(off == -1)
+      f->off = o;
+    iunlock(f->ip);
+    end_op();
+    return tot;
   }
 
-  return ret;
+  for(i = 0; i < iovcnt; i++){
+    n = iov[i].iov_len;
+    if(f->type == FD_PIPE){
+      r = pipewrite(f->pipe, (uint64)iov[i].iov_base, n);
+    } else if(f->type == FD_DEVICE){
+      if(f->major < 0 || f->major >= NDEV || !devsw[f->major].write)
+        return -1;
+      r = devsw[f->major].write(1, (uint64)iov[i].iov_base, n);
+    } else {
+      panic("filewrite");
+    }
+    if(r < 0)
+      return tot > 0 ? tot : -1;
+    tot += r;
+    if(r < n)
+      break;
+  }
+  return tot;
 }
 
@@ -15,6 +15,8 @@ struct file {
 
 // in-memory copy of an inode
 struct inode {
+  struct rcuhead rcu; // first, for ifree(); see iput()
+  struct inode *nextfree; // on itable.free
   uint dev;           // Device number
   uint inum;          // Inode number
   int ref;            // Reference count
@@ -38,3 +40,4 @@ struct devsw {
 extern struct devsw devsw[];
 
 #define CONSOLE 1
+#define STATS   2
@@ -15,10 +15,13 @@
 #include "param.h"
 #include "stat.h"
 #include "spinlock.h"
-#include "proc.h"
 #include "sleeplock.h"
+#include "rusage.h"
+#include "proc.h"
 #include "fs.h"
 #include "buf.h"
+#include "pcache.h"
+#include "rcu.h"
 #include "file.h"
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
@@ -60,29 +63,38 @@ bzero(int dev, int bno)
 
 // Blocks.
 
-// Allocate a zeroed disk block.
+// Allocate a disk block, the first free one at or after goal,
+// so that consecutive blocks of a file can be laid out next to
+// each other.  The block's contents are left as they were.
 // returns 0 if out of disk space.
 static uint
-balloc(uint dev)
+balloc(uint dev, uint goal)
 {
-  int b, bi, m;
+  int i, b, bi, m;
   struct buf *bp;
 
+  if(goal >= sb.size)
+    goal = 0;
   bp = 0;
-  for(b = 0; b < sb.size; b += BPB){
-    bp = bread(dev, BBLOCK(b, sb));
-    for(bi = 0; bi < BPB && b + bi < sb.size; bi++){
-      m = 1 << (bi % 8);
-      if((bp->data[bi/8] & m) == 0){  // Is block free?
-        bp->data[bi/8] |= m;  // Mark block in use.
-        log_write(bp);
+  for(i = 0; i < sb.size; i++){
+    b = (goal + i) % sb.size;
+    if(bp == 0 || bp->blockno != BBLOCK(b, sb)){
+      if(bp)
         brelse(bp);
-        bzero(dev, b + bi);
-        return b + bi;
-      }
+      bp = bread(dev, BBLOCK(b, sb));
+    }
+    bi = b % BPB;
+    m = 1 << (bi % 8);
+    // Is block free, and not just freed by an uncommitted transaction?
+    if((bp->data[bi/8] & m) == 0 && !log_bfreed(b)){
+      bp->data[bi/8] |= m;  // Mark block in use.
+      log_write(bp);
+      brelse(bp);
+      return b;
     }
-    brelse(bp);
   }
+  if(bp)
+    brelse(bp);
   printf("balloc: out of blocks\n");
   return 0;
 }
@@ -102,6 +114,7 @@ bfree(int dev, uint b)
   bp->data[bi/8] &= ~m;
   log_write(bp);
   brelse(bp);
+  log_bfree(b);
 }
 
 // Inodes.
@@ -134,7 +147,8 @@ bfree(int dev, uint b)
 //   the number of in-memory pointers to the entry (open
 //   files and current directories). iget() finds or
 //   creates a table entry and increments its ref; iput()
-//   decrements ref.
+//   decrements ref.  An entry whose ref falls to zero goes
+//   back on itable.free only after an RCU grace period.
 //
 // * Valid: the information (type, size, &c) in an inode
 //   table entry is only correct when ip->valid is 1.
@@ -164,10 +178,14 @@ bfree(int dev, uint b)
 // have locked the inodes involved; this lets callers create
 // multi-step atomic operations.
 //
-// The itable.lock spin-lock protects the allocation of itable
-// entries. Since ip->ref indicates whether an entry is free,
-// and ip->dev and ip->inum indicate which i-node an entry
-// holds, one must hold itable.lock while using any of those fields.
+// iget() looks inodes up without a lock, as an RCU reader, and
+// takes a reference with an atomic increment, but never from
+// zero: an entry whose last reference has gone is dead.  iput()
+// drops references with atomic decrements, and hands a dead
+// entry to call_rcu(), so that it is recycled for another inode
+// only once no lookup can still be looking at its dev and inum.
+// itable.lock protects the free list, and is held by an iget()
+// that missed, so that two can't add the same inode twice.
 //
 // An ip->lock sleep-lock protects all ip-> fields other than ref,
 // dev, and inum.  One must hold ip->lock in order to
@@ -176,6 +194,8 @@ bfree(int dev, uint b)
 struct {
   struct spinlock lock;
   struct inode inode[NINODE];
+  struct inode *free;  // entries ready for iget() to recycle
+  int npending;        // dead entries waiting for a grace period
 } itable;
 
 void
@@ -186,6 +206,8 @@ iinit()
   initlock(&itable.lock, "itable");
   for(i = 0; i < NINODE; i++) {
     initsleeplock(&itable.inode[i].lock, "inode");
+    itable.inode[i].nextfree = itable.free;
+    itable.free = &itable.inode[i];
   }
 }
 
@@ -240,50 +262,90 @@ iupdate(struct inode *ip)
   brelse(bp);
 }
 
+// Find a live table entry for inode inum on device dev, and
+// take a reference to it, or return 0.
+// Caller must be an RCU reader or hold itable.lock.
+static struct inode*
+ifind(uint dev, uint inum)
+{
+  struct inode *ip;
+  int r;
+
+  for(ip = &itable.inode[0]; ip < &itable.inode[NINODE]; ip++){
+    r = __atomic_load_n(&ip->ref, __ATOMIC_ACQUIRE);
+    if(r > 0 && ip->dev == dev && ip->inum == inum){
+      // unless its last reference goes meanwhile.
+      while(r > 0 && !__sync_bool_compare_and_swap(&ip->ref, r, r + 1))
+        r = __atomic_load_n(&ip->ref, __ATOMIC_ACQUIRE);
+      if(r > 0)
+        return ip;
+    }
+  }
+  return 0;
+}
+
 // Find the inode with number inum on device dev
 // and return the in-memory copy. Does not lock
 // the inode and does not read it from disk.
 static struct inode*
 iget(uint dev, uint inum)
 {
-  struct inode *ip, *empty;
-
-  acquire(&itable.lock);
+  struct inode *ip;
 
   // Is the inode already in the table?
-  empty = 0;
-  for(ip = &itable.inode[0]; ip < &itable.inode[NINODE]; ip++){
-    if(ip->ref > 0 && ip->dev == dev && ip->inum == inum){
-      ip->ref++;
-      release(&itable.lock);
-      return ip;
-    }
-    if(empty == 0 && ip->ref == 0)    // Remember empty slot.
-      empty = ip;
+  rcu_read_lock();
+  ip = ifind(dev, inum);
+  rcu_read_unlock();
+  if(ip)
+    return ip;
+
+  // Not there; look again holding the lock, in case another
+  // process brought it in meanwhile, and wait for a dead
+  // entry's grace period if there is no free one.
+  acquire(&itable.lock);
+  while((ip = ifind(dev, inum)) == 0 && itable.free == 0){
+    if(itable.npending == 0)
+      panic("iget: no inodes");
+    sleep(&itable.free, &itable.lock);
+  }
+  if(ip){
+    release(&itable.lock);
+    return ip;
   }
 
   // Recycle an inode entry.
-  if(empty == 0)
-    panic("iget: no inodes");
-
-  ip = empty;
+  ip = itable.free;
+  itable.free = ip->nextfree;
   ip->dev = dev;
   ip->inum = inum;
-  ip->ref = 1;
   ip->valid = 0;
+  __atomic_store_n(&ip->ref, 1, __ATOMIC_RELEASE);
   release(&itable.lock);
 
   return ip;
 }
 
+// Put a dead entry, which no lookup can see any more,
+// back on the free list.  Called by rcu_quiesce().
+static void
+ifree(struct rcuhead *h)
+{
+  struct inode *ip = (struct inode*)h;
+
+  acquire(&itable.lock);
+  ip->nextfree = itable.free;
+  itable.free = ip;
+  itable.npending--;
+  wakeup(&itable.free);
+  release(&itable.lock);
+}
+
 // Increment reference count for ip.
 // Returns ip to enable ip = idup(ip1) idiom.
 struct inode*
 idup(struct inode *ip)
 {
-  acquire(&itable.lock);
-  ip->ref++;
-  release(&itable.lock);
+  __sync_fetch_and_add(&ip->ref, 1);
   return ip;
 }
 
@@ -336,29 +398,35 @@ iunlock(struct inode *ip)
 void
 iput(struct inode *ip)
 {
-  acquire(&itable.lock);
+  int r;
 
-  if(ip->ref == 1 && ip->valid && ip->nlink == 0){
+  // not the last reference: just drop it.
+  while((r = __atomic_load_n(&ip->ref, __ATOMIC_RELAXED)) > 1)
+    if(__sync_bool_compare_and_swap(&ip->ref, r, r - 1))
+      return;
+
+  if(ip->valid && ip->nlink == 0){
     // inode has no links and no other references: truncate and free.
+    // No directory names it, so no iget() can find it.
 
     // ip->ref == 1 means no other process can have ip locked,
     // so this acquiresleep() won't block (or deadlock).
     acquiresleep(&ip->lock);
 
-    release(&itable.lock);
-
     itrunc(ip);
     ip->type = 0;
     iupdate(ip);
     ip->valid = 0;
 
     releasesleep(&ip->lock);
+  }
 
+  if(__sync_sub_and_fetch(&ip->ref, 1) == 0){
     acquire(&itable.lock);
+    itable.npending++;
+    release(&itable.lock);
+    call_rcu(&ip->rcu, ifree);
   }
-
-  ip->ref--;
-  release(&itable.lock);
 }
 
 // Common idiom: unlock, then put.
@@ -376,6 +444,21 @@ iunlockput(struct inode *ip)
 // are listed in ip->addrs[].  The next NINDIRECT blocks are
 // listed in block ip->addrs[NDIRECT].
 
+// Allocate a data block for ip, right after prev, the block
+// before it in the file, if that one is free.  Directory blocks
+// are zeroed through the log; file data blocks are left for
+// writei() to fill in.
+static uint
+bdalloc(struct inode *ip, uint prev)
+{
+  uint addr;
+
+  addr = balloc(ip->dev, prev ? prev + 1 : 0);
+  if(addr && ip->type != T_FILE)
+    bzero(ip->dev, addr);
+  return addr;
+}
+
 // Return the disk block address of the nth block in inode ip.
 // If there is no such block, bmap allocates one.
 // returns 0 if out of disk space.
@@ -387,7 +470,7 @@ bmap(struct inode *ip, uint bn)
 
   if(bn < NDIRECT){
     if((addr = ip->addrs[bn]) == 0){
-      addr = balloc(ip->dev);
+      addr = bdalloc(ip, bn > 0 ? ip->addrs[bn-1] : 0);
       if(addr == 0)
         return 0;
       ip->addrs[bn] = addr;
@@ -399,15 +482,16 @@ bmap(struct inode *ip, uint bn)
   if(bn < NINDIRECT){
     // Load indirect block, allocating if necessary.
     if((addr = ip->addrs[NDIRECT]) == 0){
-      addr = balloc(ip->dev);
+      addr = balloc(ip->dev, ip->addrs[NDIRECT-1]);
       if(addr == 0)
         return 0;
+      bzero(ip->dev, addr);
       ip->addrs[NDIRECT] = addr;
     }
     bp = bread(ip->dev, addr);
     a = (uint*)bp->data;
     if((addr = a[bn]) == 0){
-      addr = balloc(ip->dev);
+      addr = bdalloc(ip, bn > 0 ? a[bn-1] : ip->addrs[NDIRECT]);
       if(addr){
         a[bn] = addr;
         log_write(bp);
@@ -450,6 +534,7 @@ itrunc(struct inode *ip)
 
   ip->size = 0;
   iupdate(ip);
+  pcacheinval(ip->dev, ip->inum);
 }
 
 // Copy stat information from inode.
@@ -464,15 +549,78 @@ stati(struct inode *ip, struct stat *st)
   st->size = ip->size;
 }
 
+// Return a referenced page cache entry holding page pgno
+// of ip's contents, reading it from disk if necessary.
+// Bytes past the end of the file read as zeros.
+// Caller must hold ip->lock.
+// Returns 0 if the page cache has no room.
+static struct pcpage*
+ipage(struct inode *ip, uint pgno)
+{
+  struct pcpage *pg;
+  struct buf *bp;
+  uint off, addr;
+
+  if((pg = pget(ip->dev, ip->inum, pgno)) == 0)
+    return 0;
+  if(pg->valid)
+    return pg;
+
+  for(off = 0; off < PGSIZE; off += BSIZE){
+    if(pgno*PGSIZE + off >= ip->size){
+      memset(pg->data + off, 0, BSIZE);
+      continue;
+    }
+    if((addr = bmap(ip, (pgno*PGSIZE + off)/BSIZE)) == 0){
+      pput(pg);
+      return 0;
+    }
+    bp = bread(ip->dev, addr);  // counts ru_inblock if it reads the disk
+    memmove(pg->data + off, bp->data, BSIZE);
+    brelse(bp);
+  }
+  // whatever the disk holds past the end of the file, read zeros.
+  if(ip->size < (pgno+1)*PGSIZE && ip->size > pgno*PGSIZE)
+    memset(pg->data + (ip->size - pgno*PGSIZE), 0, (pgno+1)*PGSIZE - ip->size);
+  pg->valid = 1;
+  return pg;
+}
+
+// Return the physical page holding the page of ip's contents
+// at offset off, which must be page-aligned, with a reference
+// of the caller's own, for mapping into a user page table.
+// The caller drops the reference with kfree().
+// Caller must hold ip->lock.
+// Returns 0 if the page cache has no room.
+char*
+igetpage(struct inode *ip, uint off)
+{
+  struct pcpage *pg;
+  char *mem;
+
+  if(ip->type != T_FILE || (pg = ipage(ip, off/PGSIZE)) == 0)
+    return 0;
+  mem = pg->data;
+  kpageinc(mem);
+  pput(pg);
+  return mem;
+}
+
 // Read data from inode.
 // Caller must hold ip->lock.
 // If user_dst==1, then dst is a user virtual address;
 // otherwise, dst is a kernel address.
+// Regular files are read through the page cache, and whole
+// page-aligned pages are mapped copy-on-write into a heap or
+// stack buffer rather than copied.  An mmap()ed page may be
+// MAP_SHARED, and must not be replaced; see pipedonate().
 int
 readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
 {
   uint tot, m;
+  int r;
   struct buf *bp;
+  struct pcpage *pg;
 
   if(off > ip->size || off + n < off)
     return 0;
@@ -480,17 +628,28 @@ readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
     n = ip->size - off;
 
   for(tot=0; tot<n; tot+=m, off+=m, dst+=m){
-    uint addr = bmap(ip, off/BSIZE);
-    if(addr == 0)
-      break;
-    bp = bread(ip->dev, addr);
-    m = min(n - tot, BSIZE - off%BSIZE);
-    if(either_copyout(user_dst, dst, bp->data + (off % BSIZE), m) == -1) {
+    if(ip->type == T_FILE && (pg = ipage(ip, off/PGSIZE)) != 0){
+      m = min(n - tot, PGSIZE - off%PGSIZE);
+      if(user_dst && m == PGSIZE && dst%PGSIZE == 0 &&
+         dst + PGSIZE <= myproc()->mm->sz && myproc()->mm->nthread == 0 &&
+         uvmshare(myproc()->pagetable, dst, (uint64)pg->data) == 0)
+        r = 0;
+      else
+        r = either_copyout(user_dst, dst, pg->data + (off % PGSIZE), m);
+      pput(pg);
+    } else {
+      uint addr = bmap(ip, off/BSIZE);
+      if(addr == 0)
+        break;
+      bp = bread(ip->dev, addr);
+      m = min(n - tot, BSIZE - off%BSIZE);
+      r = either_copyout(user_dst, dst, bp->data + (off % BSIZE), m);
       brelse(bp);
+    }
+    if(r == -1){
       tot = -1;
       break;
     }
-    brelse(bp);
   }
   return tot;
 }
@@ -502,11 +661,15 @@ readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
 // Returns the number of bytes successfully written.
 // If the return value is less than the requested n,
 // there was an error of some kind.
+// Regular file data is written straight to disk rather than
+// through the log; see log_write_data().
 int
 writei(struct inode *ip, int user_src, uint64 src, uint off, uint n)
 {
   uint tot, m;
+  int fresh;
   struct buf *bp;
+  struct pcpage *pg;
 
   if(off > ip->size || off + n < off)
     return -1;
@@ -517,14 +680,35 @@ writei(struct inode *ip, int user_src, uint64 src, uint off, uint n)
     uint addr = bmap(ip, off/BSIZE);
     if(addr == 0)
       break;
-    bp = bread(ip->dev, addr);
     m = min(n - tot, BSIZE - off%BSIZE);
+    // no need to read a file block whose old contents
+    // will all be overwritten or lie past the end of the file.
+    fresh = ip->type == T_FILE && off%BSIZE == 0 && (m == BSIZE || off >= ip->size);
+    if(fresh)
+      bp = bnew(ip->dev, addr);
+    else
+      bp = bread(ip->dev, addr);
     if(either_copyin(bp->data + (off % BSIZE), user_src, src, m) == -1) {
+      if(fresh)
+        bp->valid = 0;
       brelse(bp);
       break;
     }
-    log_write(bp);
+    if(ip->type == T_FILE)
+      log_write_data(bp);
+    else
+      log_write(bp);
+
+    // keep a cached copy of the page up to date.
+    if(ip->type == T_FILE && (pg = plookup(ip->dev, ip->inum, off/PGSIZE)) != 0){
+      if(pg->valid && pcacheprivate(pg) == 0)
+        memmove(pg->data + (off % PGSIZE), bp->data + (off % BSIZE), m);
+      else
+        pg->valid = 0;
+      pput(pg);
+    }
     brelse(bp);
+    myproc()->ru.ru_oublock++;
   }
 
   if(off > ip->size)
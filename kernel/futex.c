@@ -0,0 +1,120 @@
+//
+// Futexes: a process blocks in futexwait() until another calls
+// futexwake() on the same word of memory, so that user-space
+// locks need only enter the kernel when they are contended.
+//
+// A waiter sleeps on the physical address of the word, which
+// threads sharing a page table and processes sharing a page of
+// a MAP_SHARED file agree on.  One of NFUTEX locks, chosen by
+// hashing that address, makes checking the word and going to
+// sleep atomic with respect to futexwake().  Wakeups can be
+// spurious, so callers must check the word again.
+//
+
+#include "types.h"
+#include "riscv.h"
+#include "defs.h"
+#include "param.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "rusage.h"
+#include "proc.h"
+
+struct spinlock futexlock[NFUTEX];
+
+void
+futexinit(void)
+{
+  for(int i = 0; i < NFUTEX; i++)
+    initlock(&futexlock[i], "futex");
+}
+
+static struct spinlock*
+futexhash(uint64 pa)
+{
+  return &futexlock[(pa >> 2) % NFUTEX];
+}
+
+// Find the physical address of the word at uaddr, faulting
+// in an untouched page of a mapped file if need be.
+// Returns 0 if uaddr isn't a word of user memory.
+static uint64
+futexaddr(struct proc *p, uint64 uaddr)
+{
+  uint64 pa;
+
+  if(uaddr % sizeof(int) != 0)
+    return 0;
+  if((pa = walkaddr(p->pagetable, uaddr)) == 0){
+    mmapprefault(uaddr, sizeof(int));
+    if((pa = walkaddr(p->pagetable, uaddr)) == 0)
+      return 0;
+  }
+  return pa + uaddr % PGSIZE;
+}
+
+// Find and lock the futex lock for the word at uaddr, setting
+// *pap to the word's physical address.
+// Returns 0 if uaddr isn't a word of user memory.
+//
+// The walk takes no mm->lock, so another thread may unmap the
+// page as we go, leaving *pap stale.  That's harmless: the page
+// stays readable through the direct map, and at worst the caller
+// returns or wakes spuriously, which futex users already expect.
+static struct spinlock*
+futexlookup(struct proc *p, uint64 uaddr, uint64 *pap)
+{
+  struct spinlock *lk;
+  uint64 pa;
+
+  for(;;){
+    if((pa = futexaddr(p, uaddr)) == 0)
+      return 0;
+    lk = futexhash(pa);
+    acquire(lk);
+    // walk again under the lock, so that a racing remap
+    // can't leave us holding the wrong lock.
+    if(walkaddr(p->pagetable, uaddr) + uaddr % PGSIZE == pa)
+      break;
+    release(lk);
+  }
+  *pap = pa;
+  return lk;
+}
+
+// If the word at uaddr holds val, sleep until a futexwake()
+// on that word or a kill().
+// Returns 0 after sleeping, -1 if the word doesn't hold val.
+int
+futexwait(uint64 uaddr, int val)
+{
+  struct spinlock *lk;
+  uint64 pa;
+
+  if((lk = futexlookup(myproc(), uaddr, &pa)) == 0)
+    return -1;
+  if(*(volatile int*)pa != val){
+    release(lk);
+    return -1;
+  }
+  sleep((void*)pa, lk);
+  release(lk);
+  return 0;
+}
+
+// Wake up to n processes waiting on the word at uaddr,
+// longest-waiting first.
+// Returns how many were woken, or -1 if uaddr is bad.
+int
+futexwake(uint64 uaddr, int n)
+{
+  struct spinlock *lk;
+  uint64 pa;
+  int r;
+
+  if((lk = futexlookup(myproc(), uaddr, &pa)) == 0)
+    return -1;
+  r = wakeupn((void*)pa, n);
+  release(lk);
+  return r;
+}
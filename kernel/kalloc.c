@@ -1,6 +1,24 @@
 // Physical memory allocator, for user processes,
-// kernel stacks, page-table pages,
-// and pipe buffers. Allocates whole 4096-byte pages.
+// kernel stacks, page-table pages, object cache slabs,
+// and pipe buffers.
+//
+// A buddy allocator: free memory is kept in blocks of 2^order
+// pages, for order 0..MAXORDER, each aligned to its size, with
+// a free list per order.  kalloc_order() splits a bigger block
+// if there is none of the size asked for; kfree_order() merges a
+// block with its buddy, the other half of the block they were
+// split from, for as long as the buddy is free too.
+//
+// Single pages, which are most of what the kernel asks for, go
+// through a per-CPU cache of up to PCPHIGH pages, so that most
+// kalloc()s and kfree()s take only their own CPU's lock; see the
+// magazines of slab.c.  When memory runs out, kreclaim() gives
+// every CPU's cache back to the buddy lists.
+//
+// Pages aren't cleared or filled with junk, unless the kernel is
+// built with KJUNK (make KJUNK=1) to catch dangling references.
+// kzalloc() hands out pages of zeroes, which each CPU prepares
+// while it has nothing to run; see kzidle().
 
 #include "types.h"
 #include "param.h"
@@ -9,6 +27,11 @@
 #include "riscv.h"
 #include "defs.h"
 
+#define MAXORDER 9   // biggest block: 2^9 pages, 2 MB
+#define PCPHIGH 32   // most pages a CPU keeps on hand
+#define PCPBATCH 16  // pages moved to or from a CPU's cache at once
+#define NZERO 16     // most zeroed pages a CPU keeps for kzalloc()
+
 void freerange(void *pa_start, void *pa_end);
 
 void dokfree(void *pa);
@@ -17,7 +40,7 @@ extern char end[]; // first address after kernel.
                    // defined by kernel.ld.
 
 struct spinlock pgcntlock;
-char pgcnt[NPHYPAGE];
+int pgcnt[NPHYPAGE];
 int pgcntidx(void *pa){
   return ((uint64)pa - KERNBASE) / PGSIZE;
 }
@@ -40,18 +63,30 @@ void kpagedec(void *pa){
 
 struct run {
   struct run *next;
+  struct run *prev;   // on a buddy free list
 };
 
 struct {
-  struct spinlock lock;
-  struct run *freelist;
+  struct spinlock lock;          // protects free, nfree and order
+  struct run *free[MAXORDER+1];  // free blocks of each order
+  uint64 nfree[MAXORDER+1];      // number of blocks on each list
+  uchar order[NPHYPAGE];         // 1 + order of the free block at each page, or 0
+  struct {
+    struct spinlock lock;        // only contended by kreclaim()
+    struct run *pages;           // free single pages
+    int n;
+    struct run *zero;            // free pages already zeroed, for kzalloc()
+    int nzero;
+  } cpu[NCPU];                   // each CPU's own cache
 } kmem;
 
 void
 kinit()
 {
-  initlock(&kmem.lock, "kmem");
+  initticketlock(&kmem.lock, "kmem");
   initlock(&pgcntlock, "pgcnt");
+  for(int i = 0; i < NCPU; i++)
+    initlock(&kmem.cpu[i].lock, "kmemcpu");
   freerange(end, (void*)PHYSTOP);
 }
 
@@ -66,25 +101,170 @@ freerange(void *pa_start, void *pa_end)
   }
 }
 
+// Put the block at page index i on the free list for order.
+// Caller must hold kmem.lock.
+static void
+buddypush(uint64 i, int order)
+{
+  struct run *r = (struct run*)(KERNBASE + i*PGSIZE);
+
+  r->prev = 0;
+  r->next = kmem.free[order];
+  if(r->next)
+    r->next->prev = r;
+  kmem.free[order] = r;
+  kmem.nfree[order]++;
+  kmem.order[i] = order + 1;
+}
+
+// Take the block at page index i off the free list for order.
+// Caller must hold kmem.lock.
+static void
+buddyunlink(uint64 i, int order)
+{
+  struct run *r = (struct run*)(KERNBASE + i*PGSIZE);
+
+  if(r->prev)
+    r->prev->next = r->next;
+  else
+    kmem.free[order] = r->next;
+  if(r->next)
+    r->next->prev = r->prev;
+  kmem.nfree[order]--;
+  kmem.order[i] = 0;
+}
+
+// Free the block of 2^order pages at pa, merging it
+// with its buddy while the buddy is free.
+// Caller must hold kmem.lock.
+static void
+buddyfree(void *pa, int order)
+{
+  uint64 i = pgcntidx(pa), b;
+
+  for(; order < MAXORDER; order++){
+    b = i ^ (1L << order);
+    if(b >= NPHYPAGE || kmem.order[b] != order + 1)
+      break;
+    buddyunlink(b, order);
+    i &= ~(1L << order);
+  }
+  buddypush(i, order);
+}
+
+// Take a block of 2^order pages off the free lists,
+// splitting a bigger one if need be.
+// Caller must hold kmem.lock.
+static void*
+buddyalloc(int order)
+{
+  uint64 i;
+  int o;
+
+  for(o = order; o <= MAXORDER && kmem.free[o] == 0; o++)
+    ;
+  if(o > MAXORDER)
+    return 0;
+  i = pgcntidx(kmem.free[o]);
+  buddyunlink(i, o);
+  // give back the upper halves.
+  while(o > order){
+    o--;
+    buddypush(i + (1L << o), o);
+  }
+  return (void*)(KERNBASE + i*PGSIZE);
+}
+
+// Take a free page from CPU c's cache, refilling it
+// from the buddy lists if it's empty.
+// Caller must hold kmem.cpu[c].lock.
+static struct run*
+pcpget(int c)
+{
+  struct run *r;
+
+  if(kmem.cpu[c].n == 0){
+    acquire(&kmem.lock);
+    while(kmem.cpu[c].n < PCPBATCH && (r = buddyalloc(0)) != 0){
+      r->next = kmem.cpu[c].pages;
+      kmem.cpu[c].pages = r;
+      kmem.cpu[c].n++;
+    }
+    release(&kmem.lock);
+  }
+  if((r = kmem.cpu[c].pages) != 0){
+    kmem.cpu[c].pages = r->next;
+    kmem.cpu[c].n--;
+  }
+  return r;
+}
+
+// Give every CPU's cached pages, zeroed ones included, back
+// to the buddy lists, so that they can be allocated anywhere
+// and merged into bigger blocks.  Called when memory is short.
+// Returns the number of pages given back.
+static int
+kreclaim(void)
+{
+  struct run *r;
+  int c, n = 0;
+
+  for(c = 0; c < NCPU; c++){
+    acquire(&kmem.cpu[c].lock);
+    acquire(&kmem.lock);
+    while((r = kmem.cpu[c].pages) != 0){
+      kmem.cpu[c].pages = r->next;
+      kmem.cpu[c].n--;
+      buddyfree(r, 0);
+      n++;
+    }
+    while((r = kmem.cpu[c].zero) != 0){
+      kmem.cpu[c].zero = r->next;
+      kmem.cpu[c].nzero--;
+      buddyfree(r, 0);
+      n++;
+    }
+    release(&kmem.lock);
+    release(&kmem.cpu[c].lock);
+  }
+  return n;
+}
+
 // Free the page of physical memory pointed at by pa,
 // which normally should have been returned by a
 // call to kalloc().  (The exception is when
 // initializing the allocator; see kinit above.)
 void dokfree(void *pa){
   struct run *r;
+  int c;
 
   if(((uint64)pa % PGSIZE) != 0 || (char*)pa < end || (uint64)pa >= PHYSTOP)
     panic("kfree");
 
+#ifdef KJUNK
   // Fill with junk to catch dangling refs.
   memset(pa, 1, PGSIZE);
+#endif
 
   r = (struct run*)pa;
 
-  acquire(&kmem.lock);
-  r->next = kmem.freelist;
-  kmem.freelist = r;
-  release(&kmem.lock);
+  push_off();
+  c = cpuid();
+  acquire(&kmem.cpu[c].lock);
+  r->next = kmem.cpu[c].pages;
+  kmem.cpu[c].pages = r;
+  if(++kmem.cpu[c].n > PCPHIGH){
+    acquire(&kmem.lock);
+    while(kmem.cpu[c].n > PCPHIGH - PCPBATCH){
+      r = kmem.cpu[c].pages;
+      kmem.cpu[c].pages = r->next;
+      kmem.cpu[c].n--;
+      buddyfree(r, 0);
+    }
+    release(&kmem.lock);
+  }
+  release(&kmem.cpu[c].lock);
+  pop_off();
 }
 
 void
@@ -109,19 +289,179 @@ void *
 kalloc(void)
 {
   struct run *r;
+  int c;
+
+  push_off();
+  c = cpuid();
+  acquire(&kmem.cpu[c].lock);
+  r = pcpget(c);
+  release(&kmem.cpu[c].lock);
+  pop_off();
+
+  // out of memory; take back pages other CPUs have cached,
+  // slabs kept only by free objects, and pages from the file
+  // data cache.
+  if(r == 0 && (kreclaim() > 0 || kcachereclaim() > 0 || pcacheshrink() > 0))
+    return kalloc();
 
-  acquire(&kmem.lock);
-  r = kmem.freelist;
   if(r){
-    kmem.freelist = r->next;
     if(pgcnt[pgcntidx(r)] != 0){
       panic("kalloc: page count is not zero");
     }
     kpageinc(r);
+#ifdef KJUNK
+    memset((char*)r, 5, PGSIZE); // fill with junk
+#endif
   }
+  return (void*)r;
+}
+
+// Allocate a page of zeroes: one this CPU zeroed while it was
+// idle, if it has one, so the caller doesn't wait for it.
+// Returns 0 if the memory cannot be allocated.
+void *
+kzalloc(void)
+{
+  struct run *r;
+  int c;
+
+  push_off();
+  c = cpuid();
+  acquire(&kmem.cpu[c].lock);
+  if((r = kmem.cpu[c].zero) != 0){
+    kmem.cpu[c].zero = r->next;
+    kmem.cpu[c].nzero--;
+  }
+  release(&kmem.cpu[c].lock);
+  pop_off();
+
+  if(r == 0){
+    if((r = kalloc()) != 0)
+      memset(r, 0, PGSIZE);
+    return (void*)r;
+  }
+  r->next = 0;  // the only word that wasn't zero
+  if(pgcnt[pgcntidx(r)] != 0)
+    panic("kzalloc: page count is not zero");
+  kpageinc(r);
+  return (void*)r;
+}
+
+// Called by a CPU's scheduler when it has nothing to run:
+// zero a free page for kzalloc(), if this CPU has fewer
+// than NZERO of them.
+// Returns 1 if it zeroed a page, 0 if there was no need.
+int
+kzidle(void)
+{
+  struct run *r = 0;
+  int c;
+
+  push_off();
+  c = cpuid();
+  acquire(&kmem.cpu[c].lock);
+  if(kmem.cpu[c].nzero < NZERO)
+    r = pcpget(c);
+  release(&kmem.cpu[c].lock);
+  if(r){
+    memset(r, 0, PGSIZE);
+    acquire(&kmem.cpu[c].lock);
+    r->next = kmem.cpu[c].zero;
+    kmem.cpu[c].zero = r;
+    kmem.cpu[c].nzero++;
+    release(&kmem.cpu[c].lock);
+  }
+  pop_off();
+  return r != 0;
+}
+
+// Allocate 2^order physically contiguous pages, aligned
+// to their size.  Returns 0 if there's no such block free.
+// Free with kfree_order(); the pages can't be shared
+// copy-on-write.
+void *
+kalloc_order(int order)
+{
+  struct run *r;
+
+  if(order == 0)
+    return kalloc();
+  if(order < 0 || order > MAXORDER)
+    return 0;
+
+  acquire(&kmem.lock);
+  r = buddyalloc(order);
   release(&kmem.lock);
 
-  if(r)
-    memset((char*)r, 5, PGSIZE); // fill with junk
+  // the pages CPUs have cached might be some of those
+  // missing from a block.
+  if(r == 0 && (kreclaim() > 0 || kcachereclaim() > 0 || pcacheshrink() > 0))
+    return kalloc_order(order);
+
+  if(r){
+    if(pgcnt[pgcntidx(r)] != 0)
+      panic("kalloc_order: page count is not zero");
+    pgcnt[pgcntidx(r)] = 1;
+#ifdef KJUNK
+    memset((char*)r, 5, PGSIZE << order); // fill with junk
+#endif
+  }
   return (void*)r;
 }
+
+// Free a block that kalloc_order(order) returned.
+void
+kfree_order(void *pa, int order)
+{
+  if(order == 0){
+    kfree(pa);
+    return;
+  }
+  if(((uint64)pa % (PGSIZE << order)) != 0 || (char*)pa < end ||
+     (uint64)pa + (PGSIZE << order) > PHYSTOP)
+    panic("kfree_order");
+  if(kpagecnt(pa) != 1)
+    panic("kfree_order: page count is not one");
+  pgcnt[pgcntidx(pa)] = 0;
+
+#ifdef KJUNK
+  // Fill with junk to catch dangling refs.
+  memset(pa, 1, PGSIZE << order);
+#endif
+
+  acquire(&kmem.lock);
+  buddyfree(pa, order);
+  release(&kmem.lock);
+}
+
+// Print how much memory is free, and how it's split into
+// blocks of each order, into buf, for the statistics device.
+int
+statsbuddy(char *buf, int sz)
+{
+  uint64 nfree[MAXORDER+1], pages = 0, cached = 0, zeroed = 0;
+  int i, n, top = -1;
+
+  acquire(&kmem.lock);
+  for(i = 0; i <= MAXORDER; i++){
+    nfree[i] = kmem.nfree[i];
+    pages += nfree[i] << i;
+    if(nfree[i])
+      top = i;
+  }
+  release(&kmem.lock);
+  for(i = 0; i < NCPU; i++){
+    acquire(&kmem.cpu[i].lock);
+    cached += kmem.cpu[i].n;
+    zeroed += kmem.cpu[i].nzero;
+    release(&kmem.cpu[i].lock);
+  }
+
+  n = snprintf(buf, sz, "kmem: free %lu pages, %lu cached, %lu zeroed, biggest block order %d\n",
+               pages, cached, zeroed, top);
+  n += snprintf(buf+n, sz-n, "kmem blocks by order:");
+  for(i = 0; i <= MAXORDER; i++)
+    n += snprintf(buf+n, sz-n, " %lu", nfree[i]);
+  n += snprintf(buf+n, sz-n, "\n");
+  return n;
+}
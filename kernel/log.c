@@ -29,6 +29,14 @@
 //   block C
 //   ...
 // Log appends are synchronous.
+//
+// File data blocks don't go through the log ("ordered" mode):
+// writei() writes them straight to their home locations with
+// log_write_data(), before the transaction that makes them part
+// of a file commits, so bulk data is written to disk once rather
+// than twice.  So that a crash can't leave a file pointing at
+// data written for another file, a block freed by a transaction
+// is not reallocated until that transaction commits.
 
 // Contents of the header block, used for both the on-disk header block
 // and to keep track in memory of logged block# before commit.
@@ -45,6 +53,7 @@ struct log {
   int committing;  // in commit(), please wait.
   int dev;
   struct logheader lh;
+  uchar freed[(FSSIZE+7)/8]; // blocks freed since the last commit
 };
 struct log log;
 
@@ -56,6 +65,8 @@ initlog(int dev, struct superblock *sb)
 {
   if (sizeof(struct logheader) >= BSIZE)
     panic("initlog: too big logheader");
+  if (sb->size > FSSIZE)
+    panic("initlog: file system bigger than FSSIZE");
 
   initlock(&log.lock, "log");
   log.start = sb->logstart;
@@ -158,8 +169,9 @@ end_op(void)
   } else {
     // begin_op() may be waiting for log space,
     // and decrementing log.outstanding has decreased
-    // the amount of reserved space.
-    wakeup(&log);
+    // the amount of reserved space, by enough
+    // for one more operation.
+    wakeone(&log);
   }
   release(&log.lock);
 
@@ -200,6 +212,7 @@ commit()
     log.lh.n = 0;
     write_head();    // Erase the transaction from the log
   }
+  memset(log.freed, 0, sizeof(log.freed));
 }
 
 // Caller has modified b->data and is done with the buffer.
@@ -234,3 +247,50 @@ log_write(struct buf *b)
   release(&log.lock);
 }
 
+
+// Write file data block b, which the caller has modified,
+// straight to its home location instead of through the log.
+// If b is already part of the current transaction, log it as
+// usual instead, so that installing the transaction later
+// can't overwrite the new data.
+void
+log_write_data(struct buf *b)
+{
+  int i, logged;
+
+  acquire(&log.lock);
+  if (log.outstanding < 1)
+    panic("log_write_data outside of trans");
+  logged = 0;
+  for (i = 0; i < log.lh.n; i++) {
+    if (log.lh.block[i] == b->blockno)
+      logged = 1;
+  }
+  release(&log.lock);
+
+  if (logged)
+    log_write(b);
+  else
+    bwrite(b);
+}
+
+// Record that the current transaction freed block b.
+void
+log_bfree(uint b)
+{
+  acquire(&log.lock);
+  log.freed[b/8] |= 1 << (b%8);
+  release(&log.lock);
+}
+
+// Was block b freed by a transaction that hasn't committed yet?
+int
+log_bfreed(uint b)
+{
+  int r;
+
+  acquire(&log.lock);
+  r = (log.freed[b/8] & (1 << (b%8))) != 0;
+  release(&log.lock);
+  return r;
+}
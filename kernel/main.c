@@ -12,6 +12,7 @@ main()
 {
   if(cpuid() == 0){
     consoleinit();
+    statsinit();
     printfinit();
     printf("\n");
     printf("xv6 kernel is booting\n");
@@ -20,13 +21,17 @@ main()
     kvminit();       // create kernel page table
     kvminithart();   // turn on paging
     procinit();      // process table
+    rcuinit();       // deferred frees for lock-free readers
+    futexinit();     // user-space wait queues
     trapinit();      // trap vectors
     trapinithart();  // install kernel trap vector
     plicinit();      // set up interrupt controller
     plicinithart();  // ask PLIC for device interrupts
     binit();         // buffer cache
+    pcacheinit();    // file data page cache
     iinit();         // inode table
     fileinit();      // file table
+    pipeinit();      // pipe allocator
     virtio_disk_init(); // emulated hard disk
     userinit();      // first user process
     __sync_synchronize();
@@ -17,6 +17,10 @@
 // end -- start of kernel page allocation area
 // PHYSTOP -- end RAM used by the kernel
 
+// frequency of the time CSR, in ticks per second.
+#define TIMEBASE 10000000L
+#define TICKCYCLES (TIMEBASE / HZ)
+
 // qemu puts UART registers here in physical memory.
 #define UART0 0x10000000L
 #define UART0_IRQ 10
@@ -55,6 +59,15 @@
 //   fixed-size stack
 //   expandable heap
 //   ...
+//   mmap()ed regions, allocated downward from MMAPTOP
+//   trapframes of threads 1..NTHREAD-1, downward
 //   TRAPFRAME (p->trapframe, used by the trampoline)
 //   TRAMPOLINE (the same page as in the kernel)
 #define TRAPFRAME (TRAMPOLINE - PGSIZE)
+
+// threads sharing a page table each have a trapframe of their
+// own, in slot p->tslot.
+#define THREADFRAME(t) (TRAPFRAME - (t)*PGSIZE)
+
+// mmap() places regions just below the trapframes.
+#define MMAPTOP THREADFRAME(NTHREAD-1)
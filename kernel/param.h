@@ -1,14 +1,26 @@
-#define NPROC        64  // maximum number of processes
+#define NPROC       512  // maximum number of processes
+#define NPIDHASH     64  // buckets in the pid hash table
+#define NWAITQ       31  // sleep()/wakeup() wait queues
+#define NFUTEX       31  // futexwait()/futexwake() locks
+#define NICEMIN     -20  // highest-priority nice value
+#define NICEMAX      19  // lowest-priority nice value
+#define HZ           10  // clock ticks per second
+#define IDLETICKS    10  // most ticks a hart with nothing else to run skips
 #define NCPU          8  // maximum number of CPUs
 #define NOFILE       16  // open files per process
-#define NFILE       100  // open files per system
+#define NTHREAD      16  // threads per process, the first included
+#define NVMA         16  // mmap()ed regions per process
+#define NFILE      1000  // open files per system
+#define NMAG         16  // free objects each CPU keeps per kcache
 #define NINODE       50  // maximum number of active i-nodes
 #define NDEV         10  // maximum major device number
 #define ROOTDEV       1  // device number of file system root disk
 #define MAXARG       32  // max exec arguments
+#define MAXIOV       16  // max buffers per readv()/writev()
 #define MAXOPBLOCKS  10  // max # of blocks any FS op writes
 #define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
 #define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
+#define NPCACHE      128  // pages in file data cache
 #define FSSIZE       2000  // size of file system in blocks
 #define MAXPATH      128   // maximum file path name
 #define USERSTACK    1     // user stack pages
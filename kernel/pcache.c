@@ -0,0 +1,205 @@
+// File data page cache.
+//
+// The page cache holds the contents of regular files in whole
+// 4096-byte kalloc() pages, separately from the buffer cache,
+// so that hot file data does not compete with metadata for
+// NBUF slots and so that readi() can hand page-aligned data
+// to user space by mapping a cached page copy-on-write
+// instead of copying it.
+//
+// Interface:
+// * To get the cache entry for page pgno of an inode, call pget.
+//   If the entry is not valid, the caller fills it.
+// * When done with the entry, call pput.
+// * Only a thread holding the inode's ip->lock may read or
+//   change an entry's data or valid flag, so entries need
+//   no sleep-lock of their own.
+// * A page that is also mapped into a user page table has
+//   kpagecnt() > 1; call pcacheprivate before changing it.
+//
+// pcache.lock protects the identity, refcnt and LRU order
+// of the entries.
+
+#include "types.h"
+#include "param.h"
+#include "spinlock.h"
+#include "riscv.h"
+#include "defs.h"
+#include "pcache.h"
+
+struct {
+  struct spinlock lock;
+  struct pcpage page[NPCACHE];
+
+  // Linked list of all entries, through prev/next.
+  // Sorted by how recently the entry was used.
+  // head.next is most recent, head.prev is least.
+  struct pcpage head;
+} pcache;
+
+void
+pcacheinit(void)
+{
+  struct pcpage *pg;
+
+  initticketlock(&pcache.lock, "pcache");
+
+  pcache.head.prev = &pcache.head;
+  pcache.head.next = &pcache.head;
+  for(pg = pcache.page; pg < pcache.page+NPCACHE; pg++){
+    pg->next = pcache.head.next;
+    pg->prev = &pcache.head;
+    pcache.head.next->prev = pg;
+    pcache.head.next = pg;
+  }
+}
+
+// Look through the page cache for page pgno of inode inum on
+// device dev.  If not found, recycle the least recently used
+// unreferenced entry and give it a page of memory.
+// In either case, return a referenced entry.
+// Returns 0 if every entry is in use or memory is short;
+// the caller should then go through the buffer cache.
+struct pcpage*
+pget(uint dev, uint inum, uint pgno)
+{
+  struct pcpage *pg;
+
+  acquire(&pcache.lock);
+
+  // Is the page already cached?
+  for(pg = pcache.head.next; pg != &pcache.head; pg = pg->next){
+    if(pg->data && pg->dev == dev && pg->inum == inum && pg->pgno == pgno){
+      pg->refcnt++;
+      release(&pcache.lock);
+      return pg;
+    }
+  }
+
+  // Not cached.
+  // Recycle the least recently used (LRU) unused entry.
+  for(pg = pcache.head.prev; pg != &pcache.head; pg = pg->prev){
+    if(pg->refcnt == 0){
+      // a page still mapped by some process belongs to it now.
+      if(pg->data && kpagecnt(pg->data) > 1){
+        kfree(pg->data);
+        pg->data = 0;
+      }
+      if(pg->data == 0 && (pg->data = kalloc()) == 0)
+        break;
+      pg->dev = dev;
+      pg->inum = inum;
+      pg->pgno = pgno;
+      pg->valid = 0;
+      pg->refcnt = 1;
+      release(&pcache.lock);
+      return pg;
+    }
+  }
+  release(&pcache.lock);
+  return 0;
+}
+
+// Like pget, but never recycles an entry.
+// Returns 0 if the page is not cached.
+struct pcpage*
+plookup(uint dev, uint inum, uint pgno)
+{
+  struct pcpage *pg;
+
+  acquire(&pcache.lock);
+  for(pg = pcache.head.next; pg != &pcache.head; pg = pg->next){
+    if(pg->data && pg->dev == dev && pg->inum == inum && pg->pgno == pgno){
+      pg->refcnt++;
+      release(&pcache.lock);
+      return pg;
+    }
+  }
+  release(&pcache.lock);
+  return 0;
+}
+
+// Release a referenced entry.
+// Move to the head of the most-recently-used list.
+void
+pput(struct pcpage *pg)
+{
+  acquire(&pcache.lock);
+  if(pg->refcnt < 1)
+    panic("pput");
+  pg->refcnt--;
+  if(pg->refcnt == 0){
+    pg->next->prev = pg->prev;
+    pg->prev->next = pg->next;
+    pg->next = pcache.head.next;
+    pg->prev = &pcache.head;
+    pcache.head.next->prev = pg;
+    pcache.head.next = pg;
+  }
+  release(&pcache.lock);
+}
+
+// Make sure no user page table shares pg's memory, so that
+// the caller can change it in place.  Processes that mapped
+// the old page keep it as a private copy-on-write snapshot.
+// Caller must hold the inode's lock and a reference to pg.
+// Returns 0 on success, -1 if out of memory.
+int
+pcacheprivate(struct pcpage *pg)
+{
+  char *mem;
+
+  if(kpagecnt(pg->data) == 1)
+    return 0;
+  if((mem = kalloc()) == 0)
+    return -1;
+  memmove(mem, pg->data, PGSIZE);
+  kfree(pg->data);
+  pg->data = mem;
+  return 0;
+}
+
+// Forget the cached contents of inode inum on device dev,
+// e.g. because the inode has been truncated.
+// Caller must hold the inode's lock.
+void
+pcacheinval(uint dev, uint inum)
+{
+  struct pcpage *pg;
+
+  acquire(&pcache.lock);
+  for(pg = pcache.page; pg < pcache.page+NPCACHE; pg++){
+    if(pg->dev == dev && pg->inum == inum)
+      pg->valid = 0;
+  }
+  release(&pcache.lock);
+}
+
+// Give the memory of unreferenced cached pages back to
+// the page allocator.  Called by kalloc() when it runs out.
+// Returns the number of pages freed.
+int
+pcacheshrink(void)
+{
+  struct pcpage *pg;
+  int n;
+
+  // kalloc() called from pget() itself; nothing to be done.
+  push_off();
+  n = holding(&pcache.lock);
+  pop_off();
+  if(n)
+    return 0;
+
+  acquire(&pcache.lock);
+  for(pg = pcache.page; pg < pcache.page+NPCACHE; pg++){
+    if(pg->refcnt == 0 && pg->data){
+      kfree(pg->data);
+      pg->data = 0;
+      pg->valid = 0;
+      n++;
+    }
+  }
+  release(&pcache.lock);
+  return n;
+}
@@ -0,0 +1,11 @@
+struct pcpage {
+  int valid;   // has data been read from disk?
+  uint dev;
+  uint inum;
+  uint pgno;   // page number within the file
+  uint refcnt;
+  char *data;  // kalloc()ed page holding the file contents
+  struct pcpage *prev; // LRU cache list
+  struct pcpage *next;
+};
+
@@ -3,22 +3,58 @@
 #include "defs.h"
 #include "param.h"
 #include "spinlock.h"
+#include "sleeplock.h"
+#include "rusage.h"
 #include "proc.h"
 #include "fs.h"
-#include "sleeplock.h"
+#include "rcu.h"
 #include "file.h"
+#include "slab.h"
+
+// The ring buffer is a block of 2^PIPEORDER contiguous pages
+// from kalloc_order(), or a single page if memory is too
+// fragmented for that; data moves in and out of it in spans of
+// contiguous bytes, not a byte at a time.  Its size is a power
+// of two, so that nread and nwrite can wrap.
+#define PIPEORDER 1
+
+// A writer of whole, page-aligned pages donates the pages
+// themselves instead, shared copy-on-write, and a reader into a
+// page-aligned buffer maps them rather than copying.  Donated
+// pages queue behind the ring: a writer donates only when the
+// ring is empty, and fills the ring only when no pages are
+// queued, so the two never hold data at the same time.
+// Must be a power of two.
+#define NPIPEPG 16
 
-#define PIPESIZE 512
+// Readers sleep on nread and writers on nwrite.  Each event
+// wakes just one of them with wakeone(), and a process that
+// leaves data or room behind wakes the next.
 
 struct pipe {
   struct spinlock lock;
-  char data[PIPESIZE];
+  char *data;     // ring buffer of size bytes
+  uint size;      // PGSIZE << order
+  int order;      // as passed to kalloc_order()
   uint nread;     // number of bytes read
   uint nwrite;    // number of bytes written
+  uint64 pg[NPIPEPG]; // physical addresses of donated pages
+  uint pgread;    // number of donated pages read
+  uint pgwrite;   // number of donated pages written
+  uint pgoff;     // bytes read so far of pg[pgread % NPIPEPG]
   int readopen;   // read fd is still open
   int writeopen;  // write fd is still open
 };
 
+// struct pipes come from pipecache, several to a page.
+static struct kcache pipecache;
+
+void
+pipeinit(void)
+{
+  kcacheinit(&pipecache, "pipe", sizeof(struct pipe));
+}
+
 int
 pipealloc(struct file **f0, struct file **f1)
 {
@@ -28,12 +64,22 @@ pipealloc(struct file **f0, struct file **f1)
   *f0 = *f1 = 0;
   if((*f0 = filealloc()) == 0 || (*f1 = filealloc()) == 0)
     goto bad;
-  if((pi = (struct pipe*)kalloc()) == 0)
+  if((pi = kcachealloc(&pipecache)) == 0)
     goto bad;
+  pi->order = PIPEORDER;
+  if((pi->data = kalloc_order(pi->order)) == 0){
+    pi->order = 0;
+    if((pi->data = kalloc()) == 0)
+      goto bad;
+  }
+  pi->size = PGSIZE << pi->order;
   pi->readopen = 1;
   pi->writeopen = 1;
   pi->nwrite = 0;
   pi->nread = 0;
+  pi->pgwrite = 0;
+  pi->pgread = 0;
+  pi->pgoff = 0;
   initlock(&pi->lock, "pipe");
   (*f0)->type = FD_PIPE;
   (*f0)->readable = 1;
@@ -46,8 +92,11 @@ pipealloc(struct file **f0, struct file **f1)
   return 0;
 
  bad:
-  if(pi)
-    kfree((char*)pi);
+  if(pi){
+    if(pi->data)
+      kfree_order(pi->data, pi->order);
+    kcachefree(&pipecache, pi);
+  }
   if(*f0)
     fileclose(*f0);
   if(*f1)
@@ -68,63 +117,145 @@ pipeclose(struct pipe *pi, int writable)
   }
   if(pi->readopen == 0 && pi->writeopen == 0){
     release(&pi->lock);
-    kfree((char*)pi);
+    freelock(&pi->lock);
+    for(; pi->pgread != pi->pgwrite; pi->pgread++)
+      kfree((void*)pi->pg[pi->pgread % NPIPEPG]);
+    kfree_order(pi->data, pi->order);
+    kcachefree(&pipecache, pi);
   } else
     release(&pi->lock);
 }
 
+// Return how many of n bytes can be copied in one go at
+// position pos of pi's ring, given that avail bytes are free
+// (or full).
+static int
+pipespan(struct pipe *pi, uint pos, uint avail, int n)
+{
+  uint m = pi->size - pos % pi->size;
+
+  if(m > avail)
+    m = avail;
+  if(m > n)
+    m = n;
+  return m;
+}
+
+// If the n bytes at user address va start with a whole page
+// that can be donated, queue the page itself on the pipe.
+// Only pages of the heap and stack qualify; an mmap()ed page
+// may be MAP_SHARED, and must not turn copy-on-write.  Nor may
+// any page of an address space shared by threads (see clone()).
+// Returns 0 if it did, -1 if not.
+static int
+pipedonate(struct pipe *pi, struct proc *pr, uint64 va, int n)
+{
+  uint64 pa;
+
+  if(n < PGSIZE || va % PGSIZE != 0 || va + PGSIZE > pr->mm->sz ||
+     pr->mm->nthread > 0)
+    return -1;
+  if(pi->nread != pi->nwrite || pi->pgwrite == pi->pgread + NPIPEPG)
+    return -1;
+  if((pa = uvmdonate(pr->pagetable, va)) == 0)
+    return -1;
+  pi->pg[pi->pgwrite++ % NPIPEPG] = pa;
+  return 0;
+}
+
 int
 pipewrite(struct pipe *pi, uint64 addr, int n)
 {
-  int i = 0;
+  int i = 0, m;
   struct proc *pr = myproc();
 
   acquire(&pi->lock);
   while(i < n){
     if(pi->readopen == 0 || killed(pr)){
+      wakeone(&pi->nwrite);
       release(&pi->lock);
       return -1;
     }
-    if(pi->nwrite == pi->nread + PIPESIZE){ //DOC: pipewrite-full
-      wakeup(&pi->nread);
+    if(pipedonate(pi, pr, addr + i, n - i) == 0){
+      i += PGSIZE;
+    } else if(pi->pgwrite != pi->pgread ||
+              pi->nwrite == pi->nread + pi->size){ //DOC: pipewrite-full
+      wakeone(&pi->nread);
       sleep(&pi->nwrite, &pi->lock);
     } else {
-      char ch;
-      if(copyin(pr->pagetable, &ch, addr + i, 1) == -1)
+      m = pipespan(pi, pi->nwrite, pi->nread + pi->size - pi->nwrite, n - i);
+      if(copyin(pr->pagetable, &pi->data[pi->nwrite % pi->size], addr + i, m) == -1)
         break;
-      pi->data[pi->nwrite++ % PIPESIZE] = ch;
-      i++;
+      pi->nwrite += m;
+      i += m;
     }
   }
-  wakeup(&pi->nread);
+  wakeone(&pi->nread);
+  if(pi->pgwrite == pi->pgread && pi->nwrite != pi->nread + pi->size)
+    wakeone(&pi->nwrite);  // room for another writer
   release(&pi->lock);
 
   return i;
 }
 
+// Read up to n bytes from the donated pages into user address
+// addr, mapping each whole page into a page-aligned heap or
+// stack buffer instead of copying it.
+static int
+pipereadpages(struct pipe *pi, struct proc *pr, uint64 addr, int n)
+{
+  int i, m;
+  uint64 pa, va;
+
+  for(i = 0; i < n && pi->pgread != pi->pgwrite; i += m){
+    pa = pi->pg[pi->pgread % NPIPEPG];
+    va = addr + i;
+    m = PGSIZE - pi->pgoff;
+    if(m > n - i)
+      m = n - i;
+    if(m < PGSIZE || va % PGSIZE != 0 || va + PGSIZE > pr->mm->sz ||
+       pr->mm->nthread > 0 || uvmshare(pr->pagetable, va, pa) < 0){
+      if(copyout(pr->pagetable, va, (char*)pa + pi->pgoff, m) == -1)
+        break;
+    }
+    pi->pgoff += m;
+    if(pi->pgoff == PGSIZE){
+      kfree((void*)pa);
+      pi->pgoff = 0;
+      pi->pgread++;
+    }
+  }
+  return i;
+}
+
 int
 piperead(struct pipe *pi, uint64 addr, int n)
 {
-  int i;
+  int i, m;
   struct proc *pr = myproc();
-  char ch;
 
   acquire(&pi->lock);
-  while(pi->nread == pi->nwrite && pi->writeopen){  //DOC: pipe-empty
+  while(pi->nread == pi->nwrite && pi->pgread == pi->pgwrite &&
+        pi->writeopen){  //DOC: pipe-empty
     if(killed(pr)){
       release(&pi->lock);
       return -1;
     }
     sleep(&pi->nread, &pi->lock); //DOC: piperead-sleep
   }
-  for(i = 0; i < n; i++){  //DOC: piperead-copy
-    if(pi->nread == pi->nwrite)
-      break;
-    ch = pi->data[pi->nread++ % PIPESIZE];
-    if(copyout(pr->pagetable, addr + i, &ch, 1) == -1)
-      break;
+  if(pi->pgread != pi->pgwrite){
+    i = pipereadpages(pi, pr, addr, n);
+  } else {
+    for(i = 0; i < n && pi->nread != pi->nwrite; i += m){  //DOC: piperead-copy
+      m = pipespan(pi, pi->nread, pi->nwrite - pi->nread, n - i);
+      if(copyout(pr->pagetable, addr + i, &pi->data[pi->nread % pi->size], m) == -1)
+        break;
+      pi->nread += m;
+    }
   }
-  wakeup(&pi->nwrite);  //DOC: piperead-wakeup
+  wakeone(&pi->nwrite);  //DOC: piperead-wakeup
+  if(pi->nread != pi->nwrite || pi->pgread != pi->pgwrite)
+    wakeone(&pi->nread);  // data left for another reader
   release(&pi->lock);
   return i;
 }
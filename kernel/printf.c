@@ -9,10 +9,12 @@
 #include "spinlock.h"
 #include "sleeplock.h"
 #include "fs.h"
+#include "rcu.h"
 #include "file.h"
 #include "memlayout.h"
 #include "riscv.h"
 #include "defs.h"
+#include "rusage.h"
 #include "proc.h"
 
 volatile int panicked = 0;
@@ -3,12 +3,31 @@
 #include "memlayout.h"
 #include "riscv.h"
 #include "spinlock.h"
+#include "sleeplock.h"
+#include "rusage.h"
 #include "proc.h"
 #include "defs.h"
 
 struct cpu cpus[NCPU];
 
-struct proc proc[NPROC];
+// Process slots are allocated a page at a time, as forks need
+// them, up to NPROC, and are never freed: an exited process's
+// slot goes on the free list for the next fork().  Every slot
+// is also on the all list, which only grows, so it can be
+// walked without locks (see procs()); freeing slots would mean
+// waiting until no such walk could still hold one, which costs
+// more than the at most NPROC slots it would give back.  The
+// lock protects the free list and the pid hash, and is acquired
+// after any p->lock.
+struct {
+  struct spinlock lock;
+  struct proc *all;              // every slot, through p->allnext
+  struct proc *free;             // UNUSED slots, through p->freenext
+  struct proc *hash[NPIDHASH];   // live processes by pid, through p->pidnext
+  int nproc;                     // slots (and kernel stacks) allocated
+} ptable;
+
+#define PIDHASH(pid) ((uint)(pid) % NPIDHASH)
 
 struct proc *initproc;
 
@@ -17,45 +36,101 @@ struct spinlock pid_lock;
 
 extern void forkret(void);
 static void freeproc(struct proc *p);
+static void addchild(struct proc *p, struct proc *c);
+static void delchild(struct proc *p, struct proc *c);
+static void setrunnable(struct proc *p);
+static void rebase(struct proc *p, struct runq *from, struct runq *to);
+static int idlestcpu(void);
 
 extern char trampoline[]; // trampoline.S
+extern pagetable_t kernel_pagetable; // vm.c
+
+// Each process keeps a list of its children, protected by its
+// p->waitlock along with each child's parent and sibling links.
+// p->waitlock helps ensure that wakeups of p wait()ing are not
+// lost, and must be acquired before any p->lock.  A process may
+// hold its own waitlock while acquiring initproc's, but otherwise
+// holds at most one waitlock.
+
+// A sleeping process waits on one of NWAITQ queues, chosen by
+// hashing its channel, so that wakeup() need only look at the
+// processes that might be sleeping on that channel.
+// A queue's lock is acquired after the lock passed to sleep()
+// and before any p->lock.
+struct waitq {
+  struct spinlock lock;
+  struct proc *head;    // longest-waiting sleeper
+  struct proc *tail;
+} waitq[NWAITQ];
+
+// Allocate another page of process slots and put them on the
+// free list.  Each gets a page for its kernel stack, mapped
+// high in memory, followed by an invalid guard page.
+// Caller must hold ptable.lock.
+// Returns 0, or -1 if NPROC slots exist or memory is short.
+static int
+procgrow(void)
+{
+  struct proc *p, *pp;
+  char *stack;
+  int i;
 
-// helps ensure that wakeups of wait()ing
-// parents are not lost. helps obey the
-// memory model when using p->parent.
-// must be acquired before any p->lock.
-struct spinlock wait_lock;
+  if(ptable.nproc >= NPROC || (pp = kzalloc()) == 0)
+    return -1;
 
-// Allocate a page for each process's kernel stack.
-// Map it high in memory, followed by an invalid
-// guard page.
-void
-proc_mapstacks(pagetable_t kpgtbl)
-{
-  struct proc *p;
-  
-  for(p = proc; p < &proc[NPROC]; p++) {
-    char *pa = kalloc();
-    if(pa == 0)
-      panic("kalloc");
-    uint64 va = KSTACK((int) (p - proc));
-    kvmmap(kpgtbl, va, (uint64)pa, PGSIZE, PTE_R | PTE_W);
+  for(i = 0; i < PGSIZE / sizeof(struct proc) && ptable.nproc < NPROC; i++){
+    p = &pp[i];
+    if((stack = kalloc()) == 0)
+      break;
+    p->kstack = KSTACK(ptable.nproc);
+    if(mappages(kernel_pagetable, p->kstack, PGSIZE, (uint64)stack, PTE_R | PTE_W) != 0){
+      kfree(stack);
+      break;
+    }
+    initlock(&p->lock, "proc");
+    initlock(&p->waitlock, "waitlock");
+    initsleeplock(&p->ownmm.lock, "mm");
+    p->ownmm.owner = p;
+    p->state = UNUSED;
+    p->freenext = ptable.free;
+    ptable.free = p;
+    p->allnext = ptable.all;
+    __atomic_store_n(&ptable.all, p, __ATOMIC_RELEASE);
+    // publish the stack mapping before the scheduler checks
+    // ptable.nproc (see scheduler()).
+    sfence_vma();
+    __atomic_store_n(&ptable.nproc, ptable.nproc + 1, __ATOMIC_RELEASE);
+  }
+
+  if(i == 0){
+    kfree(pp);
+    return -1;
   }
+  return 0;
+}
+
+// The most recently allocated process slot; follow p->allnext
+// to visit them all.  Slots are never freed, so this needs no
+// lock, but a slot's fields do.
+static struct proc*
+procs(void)
+{
+  return __atomic_load_n(&ptable.all, __ATOMIC_ACQUIRE);
 }
 
 // initialize the proc table.
 void
 procinit(void)
 {
-  struct proc *p;
-  
   initlock(&pid_lock, "nextpid");
-  initlock(&wait_lock, "wait_lock");
-  for(p = proc; p < &proc[NPROC]; p++) {
-      initlock(&p->lock, "proc");
-      p->state = UNUSED;
-      p->kstack = KSTACK((int) (p - proc));
+  for(int i = 0; i < NWAITQ; i++)
+    initlock(&waitq[i].lock, "waitq");
+  for(int i = 0; i < NCPU; i++){
+    initlock(&cpus[i].runq.lock, "runq");
+    cpus[i].nexttimer = ~0;  // until it starts taking ticks
+    cpus[i].rcuepoch = ~0;   // holds nothing until it starts
   }
+  initlock(&ptable.lock, "ptable");
 }
 
 // Must be called with interrupts disabled,
@@ -102,28 +177,40 @@ allocpid()
   return pid;
 }
 
-// Look in the process table for an UNUSED proc.
-// If found, initialize state required to run in the kernel,
-// and return with p->lock held.
+// Take an UNUSED proc from the free list, growing the process
+// table if the list is empty.
+// Initialize state required to run in the kernel,
+// and return with p->lock held.  Unless it is to be a thread,
+// give it an empty address space of its own.
 // If there are no free procs, or a memory allocation fails, return 0.
 static struct proc*
-allocproc(void)
+allocproc(int thread)
 {
   struct proc *p;
 
-  for(p = proc; p < &proc[NPROC]; p++) {
-    acquire(&p->lock);
-    if(p->state == UNUSED) {
-      goto found;
-    } else {
-      release(&p->lock);
-    }
+  acquire(&ptable.lock);
+  if(ptable.free == 0 && procgrow() < 0){
+    release(&ptable.lock);
+    return 0;
   }
-  return 0;
+  p = ptable.free;
+  ptable.free = p->freenext;
+  release(&ptable.lock);
 
-found:
+  acquire(&p->lock);
+  if(p->state != UNUSED)
+    panic("allocproc");
   p->pid = allocpid();
   p->state = USED;
+  p->nice = 0;
+  p->vruntime = 0;
+  p->mm = &p->ownmm;
+  p->tslot = 0;
+
+  acquire(&ptable.lock);
+  p->pidnext = ptable.hash[PIDHASH(p->pid)];
+  ptable.hash[PIDHASH(p->pid)] = p;
+  release(&ptable.lock);
 
   // Allocate a trapframe page.
   if((p->trapframe = (struct trapframe *)kalloc()) == 0){
@@ -133,8 +220,7 @@ found:
   }
 
   // An empty user page table.
-  p->pagetable = proc_pagetable(p);
-  if(p->pagetable == 0){
+  if(!thread && (p->pagetable = proc_pagetable(p)) == 0){
     freeproc(p);
     release(&p->lock);
     return 0;
@@ -149,19 +235,46 @@ found:
   return p;
 }
 
-// free a proc structure and the data hanging from it,
-// including user pages.
+// free the data hanging from a proc structure, including
+// user pages, and put its slot back on the free list; the
+// slot's memory is kept for good (see ptable).
 // p->lock must be held.
 static void
 freeproc(struct proc *p)
 {
+  struct proc **pp;
+
+  acquire(&ptable.lock);
+  for(pp = &ptable.hash[PIDHASH(p->pid)]; *pp; pp = &(*pp)->pidnext){
+    if(*pp == p){
+      *pp = p->pidnext;
+      break;
+    }
+  }
+  p->freenext = ptable.free;
+  ptable.free = p;
+  release(&ptable.lock);
+
+  if(p->mm != &p->ownmm){
+    // a thread: give back its trapframe slot.
+    if(p->tslot){
+      uvmunmap(p->pagetable, THREADFRAME(p->tslot), 1, 0);
+      __sync_fetch_and_and(&p->mm->slots, ~(1 << p->tslot));
+      __sync_fetch_and_sub(&p->mm->nthread, 1);
+    }
+  } else if(p->pagetable){
+    proc_freepagetable(p->pagetable, p->mm->sz);
+  }
   if(p->trapframe)
     kfree((void*)p->trapframe);
   p->trapframe = 0;
-  if(p->pagetable)
-    proc_freepagetable(p->pagetable, p->sz);
   p->pagetable = 0;
-  p->sz = 0;
+  p->mm = &p->ownmm;
+  p->ownmm.sz = 0;
+  p->ownmm.slots = 0;
+  p->tslot = 0;
+  memset(&p->ru, 0, sizeof(p->ru));
+  memset(&p->cru, 0, sizeof(p->cru));
   p->pid = 0;
   p->parent = 0;
   p->name[0] = 0;
@@ -234,13 +347,13 @@ userinit(void)
 {
   struct proc *p;
 
-  p = allocproc();
+  p = allocproc(0);
   initproc = p;
   
   // allocate one user page and copy initcode's instructions
   // and data into it.
   uvmfirst(p->pagetable, initcode, sizeof(initcode));
-  p->sz = PGSIZE;
+  p->mm->sz = PGSIZE;
 
   // prepare for the very first "return" from kernel to user.
   p->trapframe->epc = 0;      // user program counter
@@ -249,29 +362,92 @@ userinit(void)
   safestrcpy(p->name, "initcode", sizeof(p->name));
   p->cwd = namei("/");
 
-  p->state = RUNNABLE;
+  p->cpu = 0;
+  setrunnable(p);
 
   release(&p->lock);
 }
 
 // Grow or shrink user memory by n bytes.
-// Return 0 on success, -1 on failure.
-int
+// Return the old size, or -1 on failure.
+uint64
 growproc(int n)
 {
-  uint64 sz;
+  uint64 sz, oldsz;
   struct proc *p = myproc();
+  struct mm *mm = p->mm;
 
-  sz = p->sz;
+  acquiresleep(&mm->lock);
+  sz = oldsz = mm->sz;
   if(n > 0){
-    if((sz = uvmalloc(p->pagetable, sz, sz + n, PTE_W)) == 0) {
+    if(sz + n > mmapbase(p) ||
+       (sz = uvmalloc(p->pagetable, sz, sz + n, PTE_W)) == 0){
+      releasesleep(&mm->lock);
       return -1;
     }
   } else if(n < 0){
-    sz = uvmdealloc(p->pagetable, sz, sz + n);
+    if(-n > sz)
+      n = -sz;
+    sz += n;
+    if(PGROUNDUP(sz) < PGROUNDUP(oldsz))
+      mmunmap(p, PGROUNDUP(sz), (PGROUNDUP(oldsz) - PGROUNDUP(sz)) / PGSIZE);
+  }
+  mm->sz = sz;
+  releasesleep(&mm->lock);
+  return oldsz;
+}
+
+// Remove npages of p's user mappings starting at va, and free
+// the pages.  Holes are skipped.  If threads share p's page
+// table, clear the PTEs first, and free the pages only once no
+// other hart can still reach them through its TLB.
+// Caller must hold p->mm->lock.
+void
+mmunmap(struct proc *p, uint64 va, uint64 npages)
+{
+  uint64 a, end = va + npages*PGSIZE;
+  pte_t *pte;
+
+  if(p->mm->nthread == 0){
+    for(a = va; a < end; a += PGSIZE)
+      if((pte = walk(p->pagetable, a, 0)) != 0 && (*pte & PTE_V))
+        uvmunmap(p->pagetable, a, 1, 1);
+    return;
+  }
+
+  for(a = va; a < end; a += PGSIZE)
+    if((pte = walk(p->pagetable, a, 0)) != 0)
+      *pte &= ~PTE_V;
+  tlbsync(p);
+  for(a = va; a < end; a += PGSIZE){
+    if((pte = walk(p->pagetable, a, 0)) != 0 && *pte != 0){
+      kfree((void*)PTE2PA(*pte));
+      *pte = 0;
+    }
+  }
+}
+
+// Wait until no other hart can still be using a TLB entry for
+// p's page table made before the call: each hart running another
+// thread of p must have trapped into the kernel, which flushes
+// its TLB, or switched to some other process.
+void
+tlbsync(struct proc *p)
+{
+  struct cpu *c;
+  struct proc *q;
+  uint64 n;
+
+  __sync_synchronize();
+  for(c = cpus; c < &cpus[NCPU]; c++){
+    q = __atomic_load_n(&c->proc, __ATOMIC_ACQUIRE);
+    if(q == 0 || q == p || q->mm != p->mm)
+      continue;
+    n = __atomic_load_n(&c->utraps, __ATOMIC_ACQUIRE);
+    while(__atomic_load_n(&c->proc, __ATOMIC_ACQUIRE) == q &&
+          __atomic_load_n(&c->utraps, __ATOMIC_ACQUIRE) == n)
+      yield();
   }
-  p->sz = sz;
-  return 0;
 }
 
 // Create a new process, copying the parent.
@@ -284,17 +460,29 @@ fork(void)
   struct proc *p = myproc();
 
   // Allocate process.
-  if((np = allocproc()) == 0){
+  acquiresleep(&p->mm->lock);
+  if((np = allocproc(0)) == 0){
+    releasesleep(&p->mm->lock);
+    return -1;
+  }
+
+  // Copy user memory from parent to child: copy-on-write,
+  // unless threads share the parent's memory (see clone()).
+  if(uvmcopy(p->pagetable, np->pagetable, p->mm->sz, p->mm->nthread == 0) < 0){
+    freeproc(np);
+    release(&np->lock);
+    releasesleep(&p->mm->lock);
     return -1;
   }
+  np->mm->sz = p->mm->sz;
 
-  // Copy user memory from parent to child.
-  if(uvmcopy(p->pagetable, np->pagetable, p->sz) < 0){
+  // Share mmap()ed regions with the child.
+  if(mmapcopy(p, np) < 0){
     freeproc(np);
     release(&np->lock);
+    releasesleep(&p->mm->lock);
     return -1;
   }
-  np->sz = p->sz;
 
   // copy saved user registers.
   *(np->trapframe) = *(p->trapframe);
@@ -313,30 +501,296 @@ fork(void)
   pid = np->pid;
 
   release(&np->lock);
+  releasesleep(&p->mm->lock);
 
-  acquire(&wait_lock);
-  np->parent = p;
-  release(&wait_lock);
+  acquire(&p->waitlock);
+  addchild(p, np);
+  release(&p->waitlock);
 
   acquire(&np->lock);
-  np->state = RUNNABLE;
+  np->cpu = idlestcpu();
+  np->nice = p->nice;
+  np->vruntime = p->vruntime;
+  rebase(np, &mycpu()->runq, &cpus[np->cpu].runq);
+  setrunnable(np);
   release(&np->lock);
 
   return pid;
 }
 
+// Create a thread: a process that shares the caller's address
+// space, and starts by calling fn(arg) on the user stack ending
+// at stack.  Like a forked child, it gets the caller's open files
+// and current directory.  Threads are children of the address
+// space's owner, which reaps them with join(); wait() ignores
+// them.  Returns the new thread's id, or -1.
+int
+clone(uint64 fn, uint64 arg, uint64 stack)
+{
+  int i, slot, tid;
+  struct proc *np;
+  struct proc *p = myproc();
+  struct mm *mm = p->mm;
+  struct vma *v;
+
+  acquiresleep(&mm->lock);
+
+  if(mm->nthread == 0){
+    // Threads are about to share the page table, so make
+    // sure it has no copy-on-write pages: breaking one would
+    // leave other harts reading the old page through their TLBs.
+    if(uvmunshare(p->pagetable, 0, mm->sz) < 0)
+      goto bad;
+    for(v = mm->vma; v < &mm->vma[NVMA]; v++)
+      if(v->addr && uvmunshare(p->pagetable, v->addr, v->len) < 0)
+        goto bad;
+  }
+
+  for(slot = 1; slot < NTHREAD; slot++)
+    if((mm->slots & (1 << slot)) == 0)
+      break;
+  if(slot == NTHREAD || (np = allocproc(1)) == 0)
+    goto bad;
+  // The slots share a page-table page with TRAPFRAME, so this
+  // doesn't allocate, and freeproc() can unmap it without mm->lock.
+  if(mappages(p->pagetable, THREADFRAME(slot), PGSIZE,
+              (uint64)np->trapframe, PTE_R | PTE_W) != 0){
+    freeproc(np);
+    release(&np->lock);
+    goto bad;
+  }
+  __sync_fetch_and_or(&mm->slots, 1 << slot);
+  __sync_fetch_and_add(&mm->nthread, 1);
+  np->mm = mm;
+  np->pagetable = p->pagetable;
+  np->tslot = slot;
+
+  // start at fn(arg), with nowhere to return to.
+  *(np->trapframe) = *(p->trapframe);
+  np->trapframe->epc = fn;
+  np->trapframe->a0 = arg;
+  np->trapframe->sp = stack;
+  np->trapframe->ra = 0;
+
+  for(i = 0; i < NOFILE; i++)
+    if(p->ofile[i])
+      np->ofile[i] = filedup(p->ofile[i]);
+  np->cwd = idup(p->cwd);
+
+  safestrcpy(np->name, p->name, sizeof(p->name));
+
+  tid = np->pid;
+
+  release(&np->lock);
+  releasesleep(&mm->lock);
+
+  acquire(&mm->owner->waitlock);
+  addchild(mm->owner, np);
+  release(&mm->owner->waitlock);
+
+  acquire(&np->lock);
+  np->cpu = idlestcpu();
+  np->nice = p->nice;
+  np->vruntime = p->vruntime;
+  rebase(np, &mycpu()->runq, &cpus[np->cpu].runq);
+  setrunnable(np);
+  release(&np->lock);
+
+  return tid;
+
+ bad:
+  releasesleep(&mm->lock);
+  return -1;
+}
+
+// Add the counts in from to those in to.
+static void
+ruadd(struct rusage *to, struct rusage *from)
+{
+  to->ru_utime += from->ru_utime;
+  to->ru_stime += from->ru_stime;
+  to->ru_minflt += from->ru_minflt;
+  to->ru_majflt += from->ru_majflt;
+  to->ru_cowflt += from->ru_cowflt;
+  to->ru_inblock += from->ru_inblock;
+  to->ru_oublock += from->ru_oublock;
+  to->ru_nvcsw += from->ru_nvcsw;
+  to->ru_nivcsw += from->ru_nivcsw;
+}
+
+// Copy the resource usage of the caller and the threads it
+// has joined (who is RUSAGE_SELF), or of the children it has
+// reaped (RUSAGE_CHILDREN), to user address addr.
+int
+getrusage(int who, uint64 addr)
+{
+  struct proc *p = myproc();
+  struct rusage ru;
+  uint64 now;
+
+  if(who == RUSAGE_SELF){
+    // charge the time spent in this system call so far,
+    // without the scheduler charging it meanwhile.
+    push_off();
+    now = r_time();
+    p->ru.ru_stime += now - p->rustamp;
+    p->rustamp = now;
+    pop_off();
+    ru = p->ru;
+  } else if(who == RUSAGE_CHILDREN){
+    ru = p->cru;
+  } else {
+    return -1;
+  }
+  ru.ru_utime /= TIMEBASE / 1000000;
+  ru.ru_stime /= TIMEBASE / 1000000;
+  return copyout(p->pagetable, addr, (char *)&ru, sizeof(ru));
+}
+
+// Wait for thread tid of the caller's address space to exit,
+// and reap it, copying its exit status to addr.
+// Returns tid, or -1 if there is no such thread.
+int
+join(int tid, uint64 addr)
+{
+  struct proc *pp;
+  struct proc *p = myproc();
+  struct proc *o = p->mm->owner;
+
+  acquire(&o->waitlock);
+
+  for(;;){
+    for(pp = o->children; pp; pp = pp->nextsib)
+      if(pp->pid == tid && pp->mm == o->mm)
+        break;
+    if(pp == 0 || pp == p || killed(p)){
+      release(&o->waitlock);
+      return -1;
+    }
+
+    acquire(&pp->lock);
+    if(pp->state == ZOMBIE){
+      if(addr != 0 && copyout(p->pagetable, addr, (char *)&pp->xstate,
+                              sizeof(pp->xstate)) < 0) {
+        release(&pp->lock);
+        release(&o->waitlock);
+        return -1;
+      }
+      ruadd(&p->ru, &pp->ru);
+      ruadd(&p->cru, &pp->cru);
+      delchild(o, pp);
+      freeproc(pp);
+      release(&pp->lock);
+      release(&o->waitlock);
+      return tid;
+    }
+    release(&pp->lock);
+
+    // thread exit()s wake up their owner.
+    sleep(o, &o->waitlock);
+  }
+}
+
+// Kill p's threads, wait for them to exit, and reap them,
+// before p's exit() tears down the address space.
+static void
+reapthreads(struct proc *p)
+{
+  struct proc *pp, *next;
+  int n;
+
+  acquire(&p->waitlock);
+  for(;;){
+    n = 0;
+    for(pp = p->children; pp; pp = next){
+      next = pp->nextsib;
+      if(pp->mm != p->mm)
+        continue;
+      acquire(&pp->lock);
+      if(pp->state == ZOMBIE){
+        ruadd(&p->ru, &pp->ru);
+        ruadd(&p->cru, &pp->cru);
+        delchild(p, pp);
+        freeproc(pp);
+      } else {
+        pp->killed = 1;
+        if(pp->state == SLEEPING)
+          setrunnable(pp);
+        n++;
+      }
+      release(&pp->lock);
+    }
+    if(n == 0)
+      break;
+    sleep(p, &p->waitlock);
+  }
+  release(&p->waitlock);
+}
+
+// Make c a child of p.
+// Caller must hold p->waitlock, and c's old parent's, if any.
+static void
+addchild(struct proc *p, struct proc *c)
+{
+  // lockparent() reads this without a lock.
+  __atomic_store_n(&c->parent, p, __ATOMIC_RELEASE);
+  c->prevsib = 0;
+  c->nextsib = p->children;
+  if(p->children)
+    p->children->prevsib = c;
+  p->children = c;
+}
+
+// Remove c from its parent p's children.  c->parent is left
+// alone, so lockparent() never sees it 0; addchild() or
+// freeproc() overwrites it.
+// Caller must hold p->waitlock.
+static void
+delchild(struct proc *p, struct proc *c)
+{
+  if(c->prevsib)
+    c->prevsib->nextsib = c->nextsib;
+  else
+    p->children = c->nextsib;
+  if(c->nextsib)
+    c->nextsib->prevsib = c->prevsib;
+  c->nextsib = c->prevsib = 0;
+}
+
 // Pass p's abandoned children to init.
-// Caller must hold wait_lock.
+// Caller must hold p->waitlock.
 void
 reparent(struct proc *p)
 {
   struct proc *pp;
 
-  for(pp = proc; pp < &proc[NPROC]; pp++){
-    if(pp->parent == p){
-      pp->parent = initproc;
-      wakeup(initproc);
-    }
+  if(p->children == 0)
+    return;
+  acquire(&initproc->waitlock);
+  while((pp = p->children) != 0){
+    delchild(p, pp);
+    addchild(initproc, pp);
+  }
+  wakeup(initproc);
+  release(&initproc->waitlock);
+}
+
+// Lock p's parent's waitlock, which keeps p->parent from
+// changing, and return the parent.  The parent may be exiting
+// and handing p to init meanwhile, so check p->parent again
+// once its lock is held; process slots are never freed, so a
+// stale parent's lock is still safe to take.
+static struct proc*
+lockparent(struct proc *p)
+{
+  struct proc *pp;
+
+  for(;;){
+    pp = __atomic_load_n(&p->parent, __ATOMIC_ACQUIRE);
+    acquire(&pp->waitlock);
+    if(pp == p->parent)
+      return pp;
+    release(&pp->waitlock);
   }
 }
 
@@ -347,10 +801,19 @@ void
 exit(int status)
 {
   struct proc *p = myproc();
+  struct proc *pp;
 
   if(p == initproc)
     panic("init exiting");
 
+  if(p->mm == &p->ownmm){
+    // a thread exits alone, but the rest go with the owner.
+    reapthreads(p);
+
+    // Write back and unmap mmap()ed regions.
+    munmapall(p);
+  }
+
   // Close all open files.
   for(int fd = 0; fd < NOFILE; fd++){
     if(p->ofile[fd]){
@@ -365,20 +828,22 @@ exit(int status)
   end_op();
   p->cwd = 0;
 
-  acquire(&wait_lock);
-
   // Give any children to init.
+  acquire(&p->waitlock);
   reparent(p);
+  release(&p->waitlock);
+
+  pp = lockparent(p);
 
   // Parent might be sleeping in wait().
-  wakeup(p->parent);
+  wakeup(pp);
   
   acquire(&p->lock);
 
   p->xstate = status;
   p->state = ZOMBIE;
 
-  release(&wait_lock);
+  release(&pp->waitlock);
 
   // Jump into the scheduler, never to return.
   sched();
@@ -394,50 +859,200 @@ wait(uint64 addr)
   int havekids, pid;
   struct proc *p = myproc();
 
-  acquire(&wait_lock);
+  acquire(&p->waitlock);
 
   for(;;){
-    // Scan through table looking for exited children.
+    // Scan through the children looking for exited ones.
     havekids = 0;
-    for(pp = proc; pp < &proc[NPROC]; pp++){
-      if(pp->parent == p){
-        // make sure the child isn't still in exit() or swtch().
-        acquire(&pp->lock);
-
-        havekids = 1;
-        if(pp->state == ZOMBIE){
-          // Found one.
-          pid = pp->pid;
-          if(addr != 0 && copyout(p->pagetable, addr, (char *)&pp->xstate,
-                                  sizeof(pp->xstate)) < 0) {
-            release(&pp->lock);
-            release(&wait_lock);
-            return -1;
-          }
-          freeproc(pp);
+    for(pp = p->children; pp; pp = pp->nextsib){
+      if(pp->mm == p->mm)
+        continue;  // a thread; see join()
+      havekids = 1;
+
+      // make sure the child isn't still in exit() or swtch().
+      acquire(&pp->lock);
+
+      if(pp->state == ZOMBIE){
+        // Found one.
+        pid = pp->pid;
+        if(addr != 0 && copyout(p->pagetable, addr, (char *)&pp->xstate,
+                                sizeof(pp->xstate)) < 0) {
           release(&pp->lock);
-          release(&wait_lock);
-          return pid;
+          release(&p->waitlock);
+          return -1;
         }
+        ruadd(&p->cru, &pp->ru);
+        ruadd(&p->cru, &pp->cru);
+        delchild(p, pp);
+        freeproc(pp);
         release(&pp->lock);
+        release(&p->waitlock);
+        return pid;
       }
+      release(&pp->lock);
     }
 
     // No point waiting if we don't have any children.
     if(!havekids || killed(p)){
-      release(&wait_lock);
+      release(&p->waitlock);
       return -1;
     }
     
     // Wait for a child to exit.
-    sleep(p, &wait_lock);  //DOC: wait-sleep
+    sleep(p, &p->waitlock);  //DOC: wait-sleep
   }
 }
 
+// The scheduler runs the runnable process that has had the
+// least CPU time, weighted by nice value: each process has a
+// vruntime that grows while it runs, more slowly the higher its
+// priority, and each run queue is kept sorted by vruntime.
+
+// CPU share of a process at each nice value from NICEMIN
+// to NICEMAX, relative to NICE0WEIGHT; each step is worth
+// about 10% of the CPU.
+#define NICE0WEIGHT 1024
+static const int niceweight[NICEMAX - NICEMIN + 1] = {
+  /* -20 */ 88761, 71755, 56483, 46273, 36291,
+  /* -15 */ 29154, 23254, 18705, 14949, 11916,
+  /* -10 */  9548,  7620,  6100,  4904,  3906,
+  /*  -5 */  3121,  2501,  1991,  1586,  1277,
+  /*   0 */  1024,   820,   655,   526,   423,
+  /*   5 */   335,   272,   215,   172,   137,
+  /*  10 */   110,    87,    70,    56,    45,
+  /*  15 */    36,    29,    23,    18,    15,
+};
+
+// How far behind the rest of a run queue a process's vruntime
+// may be when it wakes up, in timer cycles.  A process that
+// slept a long time runs next, but can't then keep the CPU
+// until it has caught up.
+#define SLEEPCREDIT TICKCYCLES
+
+// Move p's vruntime from run queue from's clock to to's.  Each
+// queue's minvruntime advances at its own rate, so what carries
+// over is how far p is ahead of or behind the queue it leaves.
+// Reads the minvruntimes without the queues' locks; they only
+// grow, so a stale one costs p a little fairness at most.
+// Caller must hold p->lock.
+static void
+rebase(struct proc *p, struct runq *from, struct runq *to)
+{
+  uint64 fmin, tmin;
+
+  if(from == to)
+    return;
+  fmin = __atomic_load_n(&from->minvruntime, __ATOMIC_RELAXED);
+  tmin = __atomic_load_n(&to->minvruntime, __ATOMIC_RELAXED);
+  if(p->vruntime >= fmin)
+    p->vruntime = tmin + (p->vruntime - fmin);
+  else if(fmin - p->vruntime < tmin)
+    p->vruntime = tmin - (fmin - p->vruntime);
+  else
+    p->vruntime = 0;
+}
+
+// Is CPU c taking a timer interrupt every tick, and so bound
+// to look at its run queue within a tick?
+static int
+ticking(struct cpu *c)
+{
+  return c->nexttimer <= r_time() + TICKCYCLES;
+}
+
+// Mark p RUNNABLE and put it on the run queue of the CPU it
+// last ran on, so that it is likely to find its data still in
+// that CPU's cache -- unless that CPU is skipping ticks (see
+// timer.c), in which case it may not notice p for a while, and
+// can't be made to, so p goes on this CPU's queue instead.
+// p->vruntime is on the clock of p->cpu's queue.
+// Caller must hold p->lock.
+static void
+setrunnable(struct proc *p)
+{
+  struct cpu *c = &cpus[p->cpu], *me = mycpu();
+  struct runq *rq;
+  struct proc **pp;
+
+  p->state = RUNNABLE;
+  acquire(&c->runq.lock);
+  if(c != me && !ticking(c)){
+    release(&c->runq.lock);
+    c = me;
+    acquire(&c->runq.lock);
+  }
+  rq = &c->runq;
+  rebase(p, &cpus[p->cpu].runq, rq);
+  p->cpu = c - cpus;
+  if(p->vruntime + SLEEPCREDIT < rq->minvruntime)
+    p->vruntime = rq->minvruntime - SLEEPCREDIT;
+  for(pp = &rq->head; *pp && (*pp)->vruntime <= p->vruntime; pp = &(*pp)->rqnext)
+    ;
+  p->rqnext = *pp;
+  *pp = p;
+  rq->len++;
+  release(&rq->lock);
+
+  // have this CPU's timer preempt the current process.
+  if(c == me && !ticking(me))
+    timerby(r_time() + TICKCYCLES);
+}
+
+// Take the process at the head of rq, or return 0 if rq
+// is empty.
+static struct proc*
+runqget(struct runq *rq)
+{
+  struct proc *p;
+
+  acquire(&rq->lock);
+  if((p = rq->head) != 0){
+    rq->head = p->rqnext;
+    rq->len--;
+    if(p->vruntime > rq->minvruntime)
+      rq->minvruntime = p->vruntime;
+  }
+  release(&rq->lock);
+  return p;
+}
+
+// Return the CPU taking ticks with the fewest runnable
+// processes, for a new process to start on.
+// Caller must have interrupts off.
+static int
+idlestcpu(void)
+{
+  struct cpu *c, *best = mycpu();
+
+  for(c = cpus; c < &cpus[NCPU]; c++)
+    if(ticking(c) && c->runq.len < best->runq.len)
+      best = c;
+  return best - cpus;
+}
+
+// Take a runnable process for CPU c from the busiest
+// other CPU, or return 0 if there is none.
+static struct proc*
+runqsteal(struct cpu *c)
+{
+  struct cpu *victim = 0, *c1;
+  struct proc *p;
+
+  for(c1 = cpus; c1 < &cpus[NCPU]; c1++)
+    if(c1 != c && c1->runq.len > 0 &&
+       (victim == 0 || c1->runq.len > victim->runq.len))
+      victim = c1;
+  if(victim == 0 || (p = runqget(&victim->runq)) == 0)
+    return 0;
+  c->runq.steals++;
+  return p;
+}
+
 // Per-CPU process scheduler.
 // Each CPU calls scheduler() after setting itself up.
 // Scheduler never returns.  It loops, doing:
-//  - choose a process to run.
+//  - choose a process to run, from this CPU's run queue
+//    or, if that is empty, from another CPU's.
 //  - swtch to start running that process.
 //  - eventually that process transfers control
 //    via swtch back to the scheduler.
@@ -446,37 +1061,66 @@ scheduler(void)
 {
   struct proc *p;
   struct cpu *c = mycpu();
+  int id = c - cpus;
+  uint64 start, now;
 
   c->proc = 0;
+  push_off();
+  settimer();
+  pop_off();
   for(;;){
     // The most recent process to run may have had interrupts
     // turned off; enable them to avoid a deadlock if all
     // processes are waiting.
     intr_on();
-
-    int found = 0;
-    for(p = proc; p < &proc[NPROC]; p++) {
-      acquire(&p->lock);
-      if(p->state == RUNNABLE) {
-        // Switch to chosen process.  It is the process's job
-        // to release its lock and then reacquire it
-        // before jumping back to us.
-        p->state = RUNNING;
-        c->proc = p;
-        swtch(&c->context, &p->context);
-
-        // Process is done running for now.
-        // It should have changed its p->state before coming back.
-        c->proc = 0;
-        found = 1;
+    rcu_quiesce();
+
+    if((p = runqget(&c->runq)) == 0 && (p = runqsteal(c)) == 0){
+      // nothing to run; zero a page for kzalloc() if this
+      // core is short of them, or else stop running on this
+      // core until an interrupt, and skip timer ticks meanwhile.
+      if(kzidle())
+        continue;
+      push_off();
+      settimer();
+      pop_off();
+      if(c->runq.len == 0){
+        rcu_idle();
+        asm volatile("wfi");
       }
-      release(&p->lock);
+      continue;
     }
-    if(found == 0) {
-      // nothing to run; stop running on this core until an interrupt.
-      intr_on();
-      asm volatile("wfi");
+
+    // p is RUNNABLE and on no run queue, so no other CPU
+    // can choose it.
+    acquire(&p->lock);
+    if(p->state != RUNNABLE)
+      panic("scheduler");
+    // Switch to chosen process.  It is the process's job
+    // to release its lock and then reacquire it
+    // before jumping back to us.
+    p->state = RUNNING;
+    rebase(p, &cpus[p->cpu].runq, &c->runq);  // if stolen
+    p->cpu = id;
+    c->proc = p;
+    if(c->nstacks != __atomic_load_n(&ptable.nproc, __ATOMIC_ACQUIRE)){
+      // procgrow() mapped kernel stacks since this CPU last
+      // flushed its TLB.
+      c->nstacks = ptable.nproc;
+      sfence_vma();
     }
+    c->nswtch++;
+    start = r_time();
+    p->rustamp = start;
+    swtch(&c->context, &p->context);
+
+    // Process is done running for now.
+    // It should have changed its p->state before coming back.
+    c->proc = 0;
+    now = r_time();
+    p->vruntime += (now - start) * NICE0WEIGHT / niceweight[p->nice - NICEMIN];
+    p->ru.ru_stime += now - p->rustamp;
+    release(&p->lock);
   }
 }
 
@@ -507,13 +1151,29 @@ sched(void)
   mycpu()->intena = intena;
 }
 
+// At a timer interrupt, give up the CPU if another process
+// is waiting to run on it; otherwise keep running.
+void
+preempt(void)
+{
+  int n;
+
+  push_off();
+  n = mycpu()->runq.len;
+  pop_off();
+  if(n > 0){
+    myproc()->ru.ru_nivcsw++;
+    yield();
+  }
+}
+
 // Give up the CPU for one scheduling round.
 void
 yield(void)
 {
   struct proc *p = myproc();
   acquire(&p->lock);
-  p->state = RUNNABLE;
+  setrunnable(p);
   sched();
   release(&p->lock);
 }
@@ -542,53 +1202,144 @@ forkret(void)
   usertrapret();
 }
 
+// Return the wait queue for sleepers on chan.
+static struct waitq*
+waitqueue(void *chan)
+{
+  return &waitq[((uint64)chan >> 3) % NWAITQ];
+}
+
+// Take p off wait queue q.
+// Caller must hold q->lock.
+static void
+waitqremove(struct waitq *q, struct proc *p)
+{
+  if(p->wqprev)
+    p->wqprev->wqnext = p->wqnext;
+  else
+    q->head = p->wqnext;
+  if(p->wqnext)
+    p->wqnext->wqprev = p->wqprev;
+  else
+    q->tail = p->wqprev;
+  p->wq = 0;
+}
+
 // Atomically release lock and sleep on chan.
 // Reacquires lock when awakened.
 void
 sleep(void *chan, struct spinlock *lk)
 {
   struct proc *p = myproc();
+  struct waitq *q = waitqueue(chan);
   
   // Must acquire p->lock in order to
   // change p->state and then call sched.
-  // Once we hold p->lock, we can be
+  // Once we hold q->lock, we can be
   // guaranteed that we won't miss any wakeup
-  // (wakeup locks p->lock),
+  // (wakeup locks q->lock),
   // so it's okay to release lk.
 
+  acquire(&q->lock);
   acquire(&p->lock);  //DOC: sleeplock1
   release(lk);
+  p->ru.ru_nvcsw++;
 
   // Go to sleep.
   p->chan = chan;
   p->state = SLEEPING;
+  p->wq = q;
+  p->wqnext = 0;
+  p->wqprev = q->tail;
+  if(q->tail)
+    q->tail->wqnext = p;
+  else
+    q->head = p;
+  q->tail = p;
+  release(&q->lock);
 
   sched();
 
   // Tidy up.
   p->chan = 0;
+  release(&p->lock);
+
+  // kill() wakes a process without taking it off its queue.
+  acquire(&q->lock);
+  if(p->wq)
+    waitqremove(q, p);
+  release(&q->lock);
 
   // Reacquire original lock.
-  release(&p->lock);
   acquire(lk);
 }
 
+// Wake up at most n processes sleeping on chan,
+// longest-waiting first, and return how many were woken.
+// Must be called without any p->lock.
+int
+wakeupn(void *chan, int n)
+{
+  struct waitq *q = waitqueue(chan);
+  struct proc *p, *next;
+  int woken = 0;
+
+  acquire(&q->lock);
+  for(p = q->head; p && woken < n; p = next){
+    next = p->wqnext;
+    acquire(&p->lock);
+    if(p->state == SLEEPING && p->chan == chan) {
+      waitqremove(q, p);
+      setrunnable(p);
+      woken++;
+    }
+    release(&p->lock);
+  }
+  release(&q->lock);
+  return woken;
+}
+
 // Wake up all processes sleeping on chan.
 // Must be called without any p->lock.
 void
 wakeup(void *chan)
 {
-  struct proc *p;
+  wakeupn(chan, NPROC);
+}
 
-  for(p = proc; p < &proc[NPROC]; p++) {
-    if(p != myproc()){
-      acquire(&p->lock);
-      if(p->state == SLEEPING && p->chan == chan) {
-        p->state = RUNNABLE;
-      }
-      release(&p->lock);
-    }
-  }
+// Wake up just one process sleeping on chan, for when only
+// one can make use of the event.  A process woken this way
+// that doesn't use the event must pass it on, by calling
+// wakeone() again.
+// Must be called without any p->lock.
+void
+wakeone(void *chan)
+{
+  wakeupn(chan, 1);
+}
+
+// Add incr to the calling process's nice value, keeping it
+// within NICEMIN..NICEMAX, and return the new value.
+int
+nice(int incr)
+{
+  struct proc *p = myproc();
+  int n;
+
+  if(incr < NICEMIN - NICEMAX)
+    incr = NICEMIN - NICEMAX;
+  if(incr > NICEMAX - NICEMIN)
+    incr = NICEMAX - NICEMIN;
+
+  acquire(&p->lock);
+  n = p->nice + incr;
+  if(n < NICEMIN)
+    n = NICEMIN;
+  if(n > NICEMAX)
+    n = NICEMAX;
+  p->nice = n;
+  release(&p->lock);
+  return n;
 }
 
 // Kill the process with the given pid.
@@ -599,20 +1350,28 @@ kill(int pid)
 {
   struct proc *p;
 
-  for(p = proc; p < &proc[NPROC]; p++){
-    acquire(&p->lock);
-    if(p->pid == pid){
-      p->killed = 1;
-      if(p->state == SLEEPING){
-        // Wake process from sleep().
-        p->state = RUNNABLE;
-      }
-      release(&p->lock);
-      return 0;
-    }
+  acquire(&ptable.lock);
+  for(p = ptable.hash[PIDHASH(pid)]; p; p = p->pidnext)
+    if(p->pid == pid)
+      break;
+  release(&ptable.lock);
+  if(p == 0)
+    return -1;
+
+  // p may have been reaped since; pids aren't reused, so
+  // check that it is still the same process.
+  acquire(&p->lock);
+  if(p->pid != pid){
     release(&p->lock);
+    return -1;
   }
-  return -1;
+  p->killed = 1;
+  if(p->state == SLEEPING){
+    // Wake process from sleep().
+    setrunnable(p);
+  }
+  release(&p->lock);
+  return 0;
 }
 
 void
@@ -679,10 +1438,15 @@ procdump(void)
   [ZOMBIE]    "zombie"
   };
   struct proc *p;
+  struct cpu *c;
   char *state;
 
   printf("\n");
-  for(p = proc; p < &proc[NPROC]; p++){
+  for(c = cpus; c < &cpus[NCPU]; c++)
+    printf("cpu %d: runq %d steals %ld\n", (int)(c - cpus), c->runq.len, c->runq.steals);
+  // No locks: this is for debugging a possibly wedged machine.
+  // Slots are never freed, so the scan itself is safe.
+  for(p = procs(); p; p = p->allnext){
     if(p->state == UNUSED)
       continue;
     if(p->state >= 0 && p->state < NELEM(states) && states[p->state])
@@ -690,6 +1454,10 @@ procdump(void)
     else
       state = "???";
     printf("%d %s %s", p->pid, state, p->name);
+    printf(" user %ldms sys %ldms flt %ld/%ld cow %ld blk %ld/%ld csw %ld/%ld",
+           p->ru.ru_utime / (TIMEBASE / 1000), p->ru.ru_stime / (TIMEBASE / 1000),
+           p->ru.ru_minflt, p->ru.ru_majflt, p->ru.ru_cowflt,
+           p->ru.ru_inblock, p->ru.ru_oublock, p->ru.ru_nvcsw, p->ru.ru_nivcsw);
     printf("\n");
   }
 }
@@ -18,12 +18,29 @@ struct context {
   uint64 s11;
 };
 
+// A CPU's queue of RUNNABLE processes, in the order they
+// will run, which is by vruntime.  Acquired after any p->lock.
+struct runq {
+  struct spinlock lock;
+  struct proc *head;          // Lowest vruntime
+  int len;                    // Number of processes queued
+  uint64 minvruntime;         // Greatest vruntime taken off the queue
+  uint64 steals;              // Processes taken from other CPUs' queues
+};
+
 // Per-CPU state.
 struct cpu {
   struct proc *proc;          // The process running on this cpu, or null.
   struct context context;     // swtch() here to enter scheduler().
   int noff;                   // Depth of push_off() nesting.
   int intena;                 // Were interrupts enabled before push_off()?
+  struct runq runq;           // Processes waiting to run on this cpu.
+  uint64 nexttimer;           // When the next timer interrupt is due; runq.lock
+  uint64 ntimer;              // Number of timer interrupts taken
+  uint64 nswtch;              // Number of processes switched to
+  uint64 rcuepoch;            // rcu.epoch when last quiescent, or ~0 if idle
+  int nstacks;                // ptable.nproc when TLB last flushed
+  uint64 utraps;              // Traps from user space, each flushing the TLB
 };
 
 extern struct cpu cpus[NCPU];
@@ -79,11 +96,37 @@ struct trapframe {
   /* 280 */ uint64 t6;
 };
 
+// A region of user memory mapped by mmap().
+struct vma {
+  uint64 addr;       // Start address, page-aligned; 0 if slot is free
+  uint64 len;        // Length in bytes, page-aligned
+  int prot;          // PROT_* bits
+  int flags;         // MAP_SHARED or MAP_PRIVATE
+  struct file *f;    // Mapped file
+  uint off;          // File offset that addr maps
+};
+
+// A user address space, shared by a process and the threads
+// it clone()s.  It is embedded in the process that owns it,
+// which reaps its threads before it finishes exiting.
+// An address space with threads has no copy-on-write pages, so
+// a thread never has to change a page that another hart may
+// still have in its TLB; see clone().
+struct mm {
+  struct sleeplock lock;       // Held while changing sz, vma or mappings
+  struct proc *owner;          // Process it is embedded in
+  uint64 sz;                   // Size of process memory (bytes)
+  struct vma vma[NVMA];        // mmap()ed regions
+  int nthread;                 // Threads besides the owner
+  uint slots;                  // THREADFRAME() slots in use, a bit each
+};
+
 enum procstate { UNUSED, USED, SLEEPING, RUNNABLE, RUNNING, ZOMBIE };
 
 // Per-process state
 struct proc {
   struct spinlock lock;
+  struct spinlock waitlock;    // Protects children; wait() sleeps on it
 
   // p->lock must be held when using these:
   enum procstate state;        // Process state
@@ -91,15 +134,43 @@ struct proc {
   int killed;                  // If non-zero, have been killed
   int xstate;                  // Exit status to be returned to parent's wait
   int pid;                     // Process ID
+  int cpu;                     // CPU p last ran on, or is queued on
+  int nice;                    // Scheduling priority, NICEMIN..NICEMAX
+  uint64 vruntime;             // CPU time used, scaled by nice weight
 
-  // wait_lock must be held when using this:
+  // p->parent->waitlock must be held when using these:
   struct proc *parent;         // Parent process
+  struct proc *nextsib;        // Next child of parent
+  struct proc *prevsib;        // Previous child of parent
+
+  // p->waitlock must be held when using this:
+  struct proc *children;       // Children, through nextsib
+
+  // ptable.lock must be held when using these:
+  struct proc *freenext;       // Next UNUSED slot on the free list
+  struct proc *pidnext;        // Next process in p's pid hash chain
+  struct proc *allnext;        // Next slot; set once, read without locks
+
+  // the lock of the run queue p is on must be held when using this:
+  struct proc *rqnext;         // Next process on the run queue
+
+  // the lock of the wait queue p is on must be held when using these:
+  struct waitq *wq;            // Wait queue p is on, if any
+  struct proc *wqnext;         // Next sleeper on wq
+  struct proc *wqprev;         // Previous sleeper on wq
 
   // these are private to the process, so p->lock need not be held.
+  // p's own kernel thread, or the scheduler while p isn't running,
+  // updates p->ru; only p itself updates p->cru.
+  struct rusage ru;            // Usage; ru_utime and ru_stime in time CSR cycles
+  struct rusage cru;           // Usage of reaped children, likewise
+  uint64 rustamp;              // Time CSR when ru_utime or ru_stime was last charged
   uint64 kstack;               // Virtual address of kernel stack
-  uint64 sz;                   // Size of process memory (bytes)
-  pagetable_t pagetable;       // User page table
+  struct mm *mm;               // Address space: &p->ownmm, or the owner's
+  struct mm ownmm;             // Address space p owns, unless p is a thread
+  pagetable_t pagetable;       // User page table, p->mm's
   struct trapframe *trapframe; // data page for trampoline.S
+  int tslot;                   // Mapped at THREADFRAME(tslot) for trampoline.S
   struct context context;      // swtch() here to run process
   struct file *ofile[NOFILE];  // Open files
   struct inode *cwd;           // Current directory
@@ -0,0 +1,117 @@
+// Read-copy-update: lock-free readers, deferred frees.
+//
+// A reader brackets its lookups with rcu_read_lock() and
+// rcu_read_unlock(), which only turn off interrupts, so the
+// reader can be neither preempted nor switched away from.
+// A writer unlinks an object under whatever lock protects
+// the structure, so new readers can't find it, and hands it
+// to call_rcu().  The object's free function runs once every
+// CPU has passed a quiescent state, where it can't be in a read
+// section, and so can't still hold a pointer to the object.
+//
+// A CPU is quiescent between processes in its scheduler, on
+// each trap from user space (see usertrap()), so that a CPU
+// running one CPU-bound process still quiesces at each timer
+// interrupt, and while it idles (see rcu_idle()).  Only
+// interrupt handlers may run on an idle CPU, and they don't
+// read under RCU.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "spinlock.h"
+#include "riscv.h"
+#include "sleeplock.h"
+#include "rusage.h"
+#include "proc.h"
+#include "rcu.h"
+#include "defs.h"
+
+struct {
+  struct spinlock lock;
+  uint64 epoch;          // bumped by every call_rcu()
+  struct rcuhead *head;  // objects waiting to be freed, newest first
+} rcu;
+
+void
+rcuinit(void)
+{
+  initlock(&rcu.lock, "rcu");
+  rcu.epoch = 1;
+}
+
+void
+rcu_read_lock(void)
+{
+  push_off();
+}
+
+void
+rcu_read_unlock(void)
+{
+  pop_off();
+}
+
+// Call func(h) once no reader can still see the object
+// containing h.  Callbacks run from a scheduler, with no
+// process, so they must not sleep.
+void
+call_rcu(struct rcuhead *h, void (*func)(struct rcuhead*))
+{
+  acquire(&rcu.lock);
+  h->func = func;
+  h->epoch = rcu.epoch++;
+  h->next = rcu.head;
+  rcu.head = h;
+  release(&rcu.lock);
+}
+
+// Called by a CPU in a quiescent state.  Record that this CPU
+// has seen the current epoch, then free whatever every CPU is
+// done with: an object queued in epoch e is safe once each CPU
+// has seen an epoch after e.  CPUs that haven't started yet,
+// or are idle, have rcuepoch == ~0, and can't hold anything.
+void
+rcu_quiesce(void)
+{
+  struct cpu *c;
+  struct rcuhead *h, **hp, *done;
+  uint64 min;
+
+  __atomic_store_n(&mycpu()->rcuepoch,
+                   __atomic_load_n(&rcu.epoch, __ATOMIC_SEQ_CST), __ATOMIC_SEQ_CST);
+  if(__atomic_load_n(&rcu.head, __ATOMIC_RELAXED) == 0)
+    return;
+
+  min = ~0;
+  for(c = cpus; c < &cpus[NCPU]; c++)
+    if(__atomic_load_n(&c->rcuepoch, __ATOMIC_SEQ_CST) < min)
+      min = c->rcuepoch;
+
+  done = 0;
+  acquire(&rcu.lock);
+  for(hp = &rcu.head; (h = *hp) != 0; ){
+    if(h->epoch < min){
+      *hp = h->next;
+      h->next = done;
+      done = h;
+    } else {
+      hp = &h->next;
+    }
+  }
+  release(&rcu.lock);
+
+  while((h = done) != 0){
+    done = h->next;
+    h->func(h);
+  }
+}
+
+// Called by a CPU's scheduler before it waits for an interrupt
+// with nothing to run, so that grace periods needn't wait for
+// it to wake up.  Its next rcu_quiesce() takes it out of idle.
+void
+rcu_idle(void)
+{
+  __atomic_store_n(&mycpu()->rcuepoch, ~0UL, __ATOMIC_SEQ_CST);
+}
@@ -0,0 +1,7 @@
+// Embedded in an object that readers may still be looking
+// at after it is unlinked; see call_rcu().
+struct rcuhead {
+  struct rcuhead *next;
+  uint64 epoch;                  // rcu.epoch when queued
+  void (*func)(struct rcuhead*); // frees the object
+};
@@ -0,0 +1,15 @@
+#define RUSAGE_SELF      0   // the calling process and its joined threads
+#define RUSAGE_CHILDREN -1   // its children that have been wait()ed for
+
+// Resource usage, from getrusage().
+struct rusage {
+  uint64 ru_utime;    // microseconds in user mode
+  uint64 ru_stime;    // microseconds in the kernel
+  uint64 ru_minflt;   // page faults handled without reading a file
+  uint64 ru_majflt;   // page faults that read a file
+  uint64 ru_cowflt;   // copy-on-write pages copied
+  uint64 ru_inblock;  // file system blocks read
+  uint64 ru_oublock;  // file system blocks written
+  uint64 ru_nvcsw;    // times it gave up the CPU to wait
+  uint64 ru_nivcsw;   // times it was preempted
+};
@@ -0,0 +1,64 @@
+// Reader-writer spin locks, for tables that are searched far
+// more often than they are changed.
+
+#include "types.h"
+#include "param.h"
+#include "spinlock.h"
+#include "rwlock.h"
+#include "riscv.h"
+#include "defs.h"
+
+void
+initrwlock(struct rwlock *rw, char *name)
+{
+  initticketlock(&rw->lk, name);
+  rw->readers = 0;
+}
+
+// Acquire the lock for reading.
+// Readers don't keep each other out, but may not change
+// what the lock protects except with atomic operations.
+void
+acquireread(struct rwlock *rw)
+{
+  push_off(); // disable interrupts to avoid deadlock.
+
+  for(;;){
+    while(__atomic_load_n(&rw->lk.locked, __ATOMIC_RELAXED))
+      ;
+    // Announce this reader, then look again: a writer sets
+    // lk.locked before it counts the readers, so either it
+    // sees this reader or this reader sees it.
+    __sync_fetch_and_add(&rw->readers, 1);
+    if(__atomic_load_n(&rw->lk.locked, __ATOMIC_SEQ_CST) == 0)
+      break;
+    __sync_fetch_and_sub(&rw->readers, 1);
+  }
+  __sync_synchronize();
+}
+
+void
+releaseread(struct rwlock *rw)
+{
+  __sync_synchronize();
+  __sync_fetch_and_sub(&rw->readers, 1);
+  pop_off();
+}
+
+// Acquire the lock for writing, excluding readers and
+// other writers.  A waiting writer holds off new readers,
+// so a steady stream of lookups can't starve it.
+void
+acquirewrite(struct rwlock *rw)
+{
+  acquire(&rw->lk);
+  while(__atomic_load_n(&rw->readers, __ATOMIC_SEQ_CST) != 0)
+    ;
+  __sync_synchronize();
+}
+
+void
+releasewrite(struct rwlock *rw)
+{
+  release(&rw->lk);
+}
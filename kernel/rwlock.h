@@ -0,0 +1,7 @@
+// Reader-writer lock: any number of readers at once, or one
+// writer.  The writer holds lk, which keeps new readers out,
+// and waits for the readers already in to leave.
+struct rwlock {
+  struct spinlock lk; // held by the writer
+  uint readers;       // number of readers holding the lock
+};
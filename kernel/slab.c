@@ -0,0 +1,247 @@
+//
+// Object caches, for kernel objects smaller than a page.
+//
+// A cache carves pages from kalloc() into slabs of equal-sized
+// objects.  A slab's page starts with a struct slab, so kcachefree()
+// finds an object's slab by rounding its address down.  Slabs with
+// free objects are on the cache's partial list; a slab with none
+// leaves the list, and one whose objects have all come back is
+// returned to kalloc().
+//
+// Each CPU keeps a magazine of up to NMAG free objects per cache,
+// so most allocations and frees take only that magazine's lock,
+// which no other CPU wants unless memory is short.  An empty
+// magazine is refilled with NMAG/2 objects, and a full one gives
+// NMAG/2 back to their slabs, under kc->lock.  When kalloc() runs
+// out of pages, kcachereclaim() empties every magazine so that
+// slabs left with no objects in use can be freed.
+//
+// Lock order: a magazine's lock, then kc->lock, then kalloc()'s
+// locks.  A new slab's page is allocated holding neither, since
+// kalloc() may call kcachereclaim().
+//
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "spinlock.h"
+#include "slab.h"
+#include "riscv.h"
+#include "defs.h"
+
+struct slab {
+  struct kcache *kc;
+  struct slab *next;     // on kc->partial
+  struct slab *prev;
+  void *free;            // free objects, linked through their first word
+  int inuse;             // objects not on free
+};
+
+// the objects start here in a slab's page.
+#define SLABHDR ((sizeof(struct slab) + 15) & ~15)
+
+static struct kcache *caches;  // all caches, for statistics
+
+// Set up kc to hand out objects of size bytes.
+// Called during boot only.
+void
+kcacheinit(struct kcache *kc, char *name, uint size)
+{
+  size = (size + 15) & ~15;
+  if(size < sizeof(void*) || size > (PGSIZE - SLABHDR) / 2)
+    panic("kcacheinit");
+  initlock(&kc->lock, name);
+  kc->name = name;
+  kc->size = size;
+  kc->perslab = (PGSIZE - SLABHDR) / size;
+  kc->partial = 0;
+  kc->nslab = 0;
+  kc->nalloc = 0;
+  for(int i = 0; i < NCPU; i++){
+    initlock(&kc->mag[i].lock, "slabmag");
+    kc->mag[i].n = 0;
+  }
+  kc->next = caches;
+  caches = kc;
+}
+
+// Add a fresh slab to kc->partial.
+// Returns 0, or -1 if memory is short.
+static int
+slabgrow(struct kcache *kc)
+{
+  struct slab *s;
+  char *o;
+  int i;
+
+  if((s = kalloc()) == 0)
+    return -1;
+  acquire(&kc->lock);
+  s->kc = kc;
+  s->inuse = 0;
+  s->free = 0;
+  for(i = kc->perslab - 1; i >= 0; i--){
+    o = (char*)s + SLABHDR + i*kc->size;
+    *(void**)o = s->free;
+    s->free = o;
+  }
+  s->prev = 0;
+  s->next = kc->partial;
+  if(kc->partial)
+    kc->partial->prev = s;
+  kc->partial = s;
+  kc->nslab++;
+  release(&kc->lock);
+  return 0;
+}
+
+static void
+slabunlink(struct kcache *kc, struct slab *s)
+{
+  if(s->prev)
+    s->prev->next = s->next;
+  else
+    kc->partial = s->next;
+  if(s->next)
+    s->next->prev = s->prev;
+}
+
+// Move objects from kc's partial slabs into CPU c's
+// magazine, up to NMAG/2.
+// Caller must hold kc->mag[c].lock.
+static void
+refill(struct kcache *kc, int c)
+{
+  struct slab *s;
+  void *o;
+
+  acquire(&kc->lock);
+  while(kc->mag[c].n < NMAG/2 && kc->partial){
+    s = kc->partial;
+    o = s->free;
+    s->free = *(void**)o;
+    s->inuse++;
+    if(s->free == 0)
+      slabunlink(kc, s);
+    kc->mag[c].obj[kc->mag[c].n++] = o;
+    kc->nalloc++;
+  }
+  release(&kc->lock);
+}
+
+// Give objects from CPU c's magazine back to their slabs,
+// down to keep, freeing any slab left empty.
+// Caller must hold kc->mag[c].lock.
+static void
+drain(struct kcache *kc, int c, int keep)
+{
+  struct slab *s;
+  void *o;
+
+  acquire(&kc->lock);
+  while(kc->mag[c].n > keep){
+    o = kc->mag[c].obj[--kc->mag[c].n];
+    s = (struct slab*)PGROUNDDOWN((uint64)o);
+    if(s->kc != kc)
+      panic("kcachefree");
+    if(s->free == 0){
+      s->prev = 0;
+      s->next = kc->partial;
+      if(kc->partial)
+        kc->partial->prev = s;
+      kc->partial = s;
+    }
+    *(void**)o = s->free;
+    s->free = o;
+    kc->nalloc--;
+    if(--s->inuse == 0){
+      slabunlink(kc, s);
+      kc->nslab--;
+      kfree(s);
+    }
+  }
+  release(&kc->lock);
+}
+
+// Allocate an object from kc.
+// Returns 0 if memory is short.  The object is not zeroed.
+void*
+kcachealloc(struct kcache *kc)
+{
+  void *o = 0;
+  int c;
+
+  push_off();
+  c = cpuid();
+  acquire(&kc->mag[c].lock);
+  if(kc->mag[c].n == 0)
+    refill(kc, c);
+  if(kc->mag[c].n > 0)
+    o = kc->mag[c].obj[--kc->mag[c].n];
+  release(&kc->mag[c].lock);
+  pop_off();
+
+  // no free objects; add a slab and try again.
+  if(o == 0 && slabgrow(kc) == 0)
+    return kcachealloc(kc);
+  return o;
+}
+
+// Give back an object that kcachealloc(kc) returned.
+void
+kcachefree(struct kcache *kc, void *o)
+{
+  int c;
+
+  push_off();
+  c = cpuid();
+  acquire(&kc->mag[c].lock);
+  if(kc->mag[c].n == NMAG)
+    drain(kc, c, NMAG/2);
+  kc->mag[c].obj[kc->mag[c].n++] = o;
+  release(&kc->mag[c].lock);
+  pop_off();
+}
+
+// Empty every CPU's magazines, and free the slabs that leaves
+// with no objects in use.  Called by kalloc() when it runs out.
+// Returns the number of pages freed.
+int
+kcachereclaim(void)
+{
+  struct kcache *kc;
+  uint64 nslab;
+  int c, n = 0;
+
+  for(kc = caches; kc; kc = kc->next){
+    for(c = 0; c < NCPU; c++){
+      acquire(&kc->mag[c].lock);
+      nslab = kc->nslab;
+      drain(kc, c, 0);
+      n += nslab - kc->nslab;
+      release(&kc->mag[c].lock);
+    }
+  }
+  return n;
+}
+
+// Print each cache's object and slab counts into buf,
+// for the statistics device.
+int
+statsslab(char *buf, int sz)
+{
+  struct kcache *kc;
+  int n = 0, i;
+  uint64 cached;
+
+  for(kc = caches; kc; kc = kc->next){
+    acquire(&kc->lock);
+    cached = 0;
+    for(i = 0; i < NCPU; i++)
+      cached += kc->mag[i].n;
+    n += snprintf(buf+n, sz-n, "slab %s: size %d objects %lu cached %lu slabs %lu\n",
+                  kc->name, kc->size, kc->nalloc - cached, cached, kc->nslab);
+    release(&kc->lock);
+  }
+  return n;
+}
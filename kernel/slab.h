@@ -0,0 +1,17 @@
+// A cache of fixed-size kernel objects smaller than a page.
+// See slab.c.
+struct kcache {
+  struct spinlock lock;  // protects partial and the slabs on it
+  char *name;
+  uint size;             // bytes per object
+  uint perslab;          // objects per slab
+  struct slab *partial;  // slabs with free objects
+  uint64 nslab;          // slabs allocated
+  uint64 nalloc;         // objects out of the slabs, magazines included
+  struct {
+    struct spinlock lock;  // only contended by kcachereclaim()
+    int n;
+    void *obj[NMAG];
+  } mag[NCPU];           // free objects each CPU keeps on hand
+  struct kcache *next;   // next cache, for statistics
+};
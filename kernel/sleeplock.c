@@ -6,8 +6,9 @@
 #include "param.h"
 #include "memlayout.h"
 #include "spinlock.h"
-#include "proc.h"
 #include "sleeplock.h"
+#include "rusage.h"
+#include "proc.h"
 
 void
 initsleeplock(struct sleeplock *lk, char *name)
@@ -36,7 +37,7 @@ releasesleep(struct sleeplock *lk)
   acquire(&lk->lk);
   lk->locked = 0;
   lk->pid = 0;
-  wakeup(lk);
+  wakeone(lk);
   release(&lk->lk);
 }
 
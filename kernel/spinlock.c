@@ -5,15 +5,62 @@
 #include "memlayout.h"
 #include "spinlock.h"
 #include "riscv.h"
+#include "sleeplock.h"
+#include "rusage.h"
 #include "proc.h"
 #include "defs.h"
 
+// Every lock is on the list of all locks, for statslock(),
+// from initlock() until freelock().
+static struct spinlock *locks;
+static struct spinlock lock_locks = { .name = "lock_locks" };
+
 void
 initlock(struct spinlock *lk, char *name)
 {
   lk->name = name;
   lk->locked = 0;
+  lk->ticket = 0;
+  lk->next = 0;
+  lk->serving = 0;
   lk->cpu = 0;
+  lk->nacquire = 0;
+  lk->ncontend = 0;
+  lk->maxhold = 0;
+
+  acquire(&lock_locks);
+  lk->lprev = 0;
+  lk->lnext = locks;
+  if(locks)
+    locks->lprev = lk;
+  locks = lk;
+  release(&lock_locks);
+}
+
+// Initialize a ticket lock: instead of all waiting harts
+// racing to swap lk->locked, each takes a ticket and waits
+// for its turn.  That is fair, so no hart starves, and a
+// waiting hart only reads the lock's cache line.  For locks
+// that many harts fight over.
+void
+initticketlock(struct spinlock *lk, char *name)
+{
+  initlock(lk, name);
+  lk->ticket = 1;
+}
+
+// Forget a lock that is about to be freed.
+void
+freelock(struct spinlock *lk)
+{
+  acquire(&lock_locks);
+  if(lk->lprev)
+    lk->lprev->lnext = lk->lnext;
+  else
+    locks = lk->lnext;
+  if(lk->lnext)
+    lk->lnext->lprev = lk->lprev;
+  release(&lock_locks);
 }
 
 // Acquire the lock.
@@ -29,8 +76,16 @@ acquire(struct spinlock *lk)
   //   a5 = 1
   //   s1 = &lk->locked
   //   amoswap.w.aq a5, a5, (s1)
-  while(__sync_lock_test_and_set(&lk->locked, 1) != 0)
-    ;
+  int contended = 0;
+  if(lk->ticket){
+    uint t = __sync_fetch_and_add(&lk->next, 1);
+    while(__atomic_load_n(&lk->serving, __ATOMIC_ACQUIRE) != t)
+      contended = 1;
+    lk->locked = 1;
+  } else {
+    while(__sync_lock_test_and_set(&lk->locked, 1) != 0)
+      contended = 1;
+  }
 
   // Tell the C compiler and the processor to not move loads or stores
   // past this point, to ensure that the critical section's memory
@@ -40,6 +95,9 @@ acquire(struct spinlock *lk)
 
   // Record info about lock acquisition for holding() and debugging.
   lk->cpu = mycpu();
+  lk->nacquire++;
+  lk->ncontend += contended;
+  lk->tacquire = r_time();
 }
 
 // Release the lock.
@@ -49,6 +107,10 @@ release(struct spinlock *lk)
   if(!holding(lk))
     panic("release");
 
+  uint64 hold = r_time() - lk->tacquire;
+  if(hold > lk->maxhold)
+    lk->maxhold = hold;
+
   lk->cpu = 0;
 
   // Tell the C compiler and the CPU to not move loads or stores
@@ -66,7 +128,13 @@ release(struct spinlock *lk)
   // On RISC-V, sync_lock_release turns into an atomic swap:
   //   s1 = &lk->locked
   //   amoswap.w zero, zero, (s1)
-  __sync_lock_release(&lk->locked);
+  // A ticket lock passes to the holder of the next ticket.
+  if(lk->ticket){
+    lk->locked = 0;
+    __atomic_store_n(&lk->serving, lk->serving + 1, __ATOMIC_RELEASE);
+  } else {
+    __sync_lock_release(&lk->locked);
+  }
 
   pop_off();
 }
@@ -108,3 +176,61 @@ pop_off(void)
   if(c->noff == 0 && c->intena)
     intr_on();
 }
+
+struct locktot {
+  char *name;
+  uint64 nacquire, ncontend, maxhold;
+  int nlock;
+};
+
+// Print the counters of all the locks into buf, summed over
+// the locks of each name (there is a "proc" lock for each
+// process, for instance), most contended first.  Locks with
+// names past the first NELEM(tot) are counted in a last line.
+int
+statslock(char *buf, int sz)
+{
+  static struct locktot tot[64];  // protected by lock_locks
+  struct locktot t;
+  struct spinlock *lk;
+  int i, j, n, ntot = 0, nmore = 0;
+
+  acquire(&lock_locks);
+  for(lk = locks; lk; lk = lk->lnext){
+    for(j = 0; j < ntot; j++)
+      if(strncmp(tot[j].name, lk->name, 32) == 0)
+        break;
+    if(j == ntot){
+      if(ntot == NELEM(tot)){
+        nmore++;
+        continue;
+      }
+      tot[ntot].name = lk->name;
+      tot[ntot].nacquire = tot[ntot].ncontend = tot[ntot].maxhold = 0;
+      tot[ntot].nlock = 0;
+      ntot++;
+    }
+    tot[j].nlock++;
+    tot[j].nacquire += lk->nacquire;
+    tot[j].ncontend += lk->ncontend;
+    if(lk->maxhold > tot[j].maxhold)
+      tot[j].maxhold = lk->maxhold;
+  }
+
+  // insertion sort by contended acquires.
+  for(i = 1; i < ntot; i++){
+    t = tot[i];
+    for(j = i; j > 0 && tot[j-1].ncontend < t.ncontend; j--)
+      tot[j] = tot[j-1];
+    tot[j] = t;
+  }
+
+  n = 0;
+  for(i = 0; i < ntot; i++)
+    n += snprintf(buf+n, sz-n, "lock %s (%d): acquire %lu contended %lu maxhold %lu\n",
+                  tot[i].name, tot[i].nlock, tot[i].nacquire, tot[i].ncontend, tot[i].maxhold);
+  if(nmore)
+    n += snprintf(buf+n, sz-n, "(%d more locks under other names)\n", nmore);
+  release(&lock_locks);
+  return n;
+}
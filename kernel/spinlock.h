@@ -1,9 +1,22 @@
 // Mutual exclusion lock.
+// A ticket lock (see initticketlock()) hands itself to waiting
+// harts in the order they asked for it.
 struct spinlock {
   uint locked;       // Is the lock held?
+  uint ticket;       // Is this a ticket lock?
+  uint next;         // Ticket lock: next ticket to hand out.
+  uint serving;      // Ticket lock: ticket that may hold the lock.
 
   // For debugging:
   char *name;        // Name of lock.
   struct cpu *cpu;   // The cpu holding the lock.
+
+  // For statistics; updated only by the holder:
+  uint64 nacquire;   // Number of acquire()s.
+  uint64 ncontend;   // Number of acquire()s that found it held.
+  uint64 maxhold;    // Longest time held, in time CSR cycles.
+  uint64 tacquire;   // When the holder acquired it.
+  struct spinlock *lnext;  // List of all locks; see statslock().
+  struct spinlock *lprev;
 };
 
@@ -0,0 +1,118 @@
+//
+// formatted output to a string -- snprintf.
+//
+
+#include <stdarg.h>
+
+#include "types.h"
+#include "param.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "rcu.h"
+#include "file.h"
+#include "riscv.h"
+#include "defs.h"
+
+static char digits[] = "0123456789abcdef";
+
+static int
+sputc(char *s, char c)
+{
+  *s = c;
+  return 1;
+}
+
+static int
+sprintint(char *s, int sz, long long xx, int base, int sign)
+{
+  char buf[24];
+  int i, n;
+  unsigned long long x;
+
+  if(sign && (sign = (xx < 0)))
+    x = -xx;
+  else
+    x = xx;
+
+  i = 0;
+  do {
+    buf[i++] = digits[x % base];
+  } while((x /= base) != 0);
+
+  if(sign)
+    buf[i++] = '-';
+
+  n = 0;
+  while(--i >= 0 && n < sz)
+    n += sputc(s+n, buf[i]);
+  return n;
+}
+
+// Print to buf, at most sz-1 characters followed by a NUL.
+// Understands %d, %ld, %u, %lu, %x, %lx, %s, and %%.
+// Returns the number of characters printed, not counting the NUL.
+int
+snprintf(char *buf, int sz, char *fmt, ...)
+{
+  va_list ap;
+  int i, c, off;
+  char *s;
+
+  if(sz <= 0)
+    return 0;
+  sz--;  // room for the NUL
+
+  va_start(ap, fmt);
+  off = 0;
+  for(i = 0; off < sz && (c = fmt[i] & 0xff) != 0; i++){
+    if(c != '%'){
+      off += sputc(buf+off, c);
+      continue;
+    }
+    c = fmt[++i] & 0xff;
+    if(c == 0)
+      break;
+    if(c == 'l'){
+      c = fmt[++i] & 0xff;
+      if(c == 'd')
+        off += sprintint(buf+off, sz-off, va_arg(ap, uint64), 10, 1);
+      else if(c == 'u')
+        off += sprintint(buf+off, sz-off, va_arg(ap, uint64), 10, 0);
+      else if(c == 'x')
+        off += sprintint(buf+off, sz-off, va_arg(ap, uint64), 16, 0);
+      else
+        break;
+      continue;
+    }
+    switch(c){
+    case 'd':
+      off += sprintint(buf+off, sz-off, va_arg(ap, int), 10, 1);
+      break;
+    case 'u':
+      off += sprintint(buf+off, sz-off, va_arg(ap, uint), 10, 0);
+      break;
+    case 'x':
+      off += sprintint(buf+off, sz-off, va_arg(ap, int), 16, 0);
+      break;
+    case 's':
+      if((s = va_arg(ap, char*)) == 0)
+        s = "(null)";
+      for(; *s && off < sz; s++)
+        off += sputc(buf+off, *s);
+      break;
+    case '%':
+      off += sputc(buf+off, '%');
+      break;
+    default:
+      // Print unknown % sequence to draw attention.
+      off += sputc(buf+off, '%');
+      if(off < sz)
+        off += sputc(buf+off, c);
+      break;
+    }
+  }
+  va_end(ap);
+  buf[off] = 0;
+  return off;
+}
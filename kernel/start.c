@@ -60,7 +60,10 @@ timerinit()
   
   // allow supervisor to use stimecmp and time.
   w_mcounteren(r_mcounteren() | 2);
+
+  // allow user programs to read time too, to time themselves.
+  w_scounteren(r_scounteren() | 2);
   
   // ask for the very first timer interrupt.
-  w_stimecmp(r_time() + 1000000);
+  w_stimecmp(r_time() + TICKCYCLES);
 }
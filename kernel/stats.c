@@ -0,0 +1,86 @@
+//
+// The statistics device: reading it gives a snapshot of
+// per-CPU scheduling counters, free memory by block size,
+// per-lock contention counters, and object cache usage,
+// as text.
+//
+
+#include "types.h"
+#include "param.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "rcu.h"
+#include "file.h"
+#include "riscv.h"
+#include "rusage.h"
+#include "proc.h"
+#include "defs.h"
+
+#define BUFSZ 4096
+
+static struct {
+  struct spinlock lock;
+  char buf[BUFSZ];
+  int sz;   // length of snapshot in buf, or 0 if none
+  int off;  // how much of it has been read
+} stats;
+
+// Print the per-CPU counters into buf.
+static int
+statscpu(char *buf, int sz)
+{
+  struct cpu *c;
+  int n = 0;
+
+  for(c = cpus; c < &cpus[NCPU]; c++){
+    if(c->nexttimer == ~0)
+      continue;  // never started
+    n += snprintf(buf+n, sz-n, "cpu %d: timer %lu switches %lu steals %lu runq %d\n",
+                  (int)(c - cpus), c->ntimer, c->nswtch, c->runq.steals, c->runq.len);
+  }
+  return n;
+}
+
+int
+statswrite(int user_src, uint64 src, int n)
+{
+  return -1;
+}
+
+// Take a snapshot of the counters at the first read, and
+// return it piece by piece, then end-of-file.
+int
+statsread(int user_dst, uint64 dst, int n)
+{
+  int m;
+
+  acquire(&stats.lock);
+  if(stats.sz == 0){
+    stats.sz = statscpu(stats.buf, BUFSZ);
+    stats.sz += statsbuddy(stats.buf + stats.sz, BUFSZ - stats.sz);
+    stats.sz += statslock(stats.buf + stats.sz, BUFSZ - stats.sz);
+    stats.sz += statsslab(stats.buf + stats.sz, BUFSZ - stats.sz);
+    stats.off = 0;
+  }
+  m = stats.sz - stats.off;
+  if(m > n)
+    m = n;
+  if(m > 0 && either_copyout(user_dst, dst, stats.buf + stats.off, m) == -1)
+    m = -1;
+  else if(m > 0)
+    stats.off += m;
+  else
+    stats.sz = 0;  // next read starts a new snapshot
+  release(&stats.lock);
+  return m;
+}
+
+void
+statsinit(void)
+{
+  initlock(&stats.lock, "stats");
+
+  devsw[STATS].read = statsread;
+  devsw[STATS].write = statswrite;
+}
@@ -3,6 +3,8 @@
 #include "memlayout.h"
 #include "riscv.h"
 #include "spinlock.h"
+#include "sleeplock.h"
+#include "rusage.h"
 #include "proc.h"
 #include "syscall.h"
 #include "defs.h"
@@ -12,7 +14,7 @@ int
 fetchaddr(uint64 addr, uint64 *ip)
 {
   struct proc *p = myproc();
-  if(addr >= p->sz || addr+sizeof(uint64) > p->sz) // both tests needed, in case of overflow
+  if(addr >= p->mm->sz || addr+sizeof(uint64) > p->mm->sz) // both tests needed, in case of overflow
     return -1;
   if(copyin(p->pagetable, (char *)ip, addr, sizeof(*ip)) != 0)
     return -1;
@@ -101,6 +103,20 @@ extern uint64 sys_unlink(void);
 extern uint64 sys_link(void);
 extern uint64 sys_mkdir(void);
 extern uint64 sys_close(void);
+extern uint64 sys_mmap(void);
+extern uint64 sys_munmap(void);
+extern uint64 sys_readv(void);
+extern uint64 sys_writev(void);
+extern uint64 sys_pread(void);
+extern uint64 sys_pwrite(void);
+extern uint64 sys_nice(void);
+extern uint64 sys_clock_gettime(void);
+extern uint64 sys_nanosleep(void);
+extern uint64 sys_clone(void);
+extern uint64 sys_join(void);
+extern uint64 sys_futexwait(void);
+extern uint64 sys_futexwake(void);
+extern uint64 sys_getrusage(void);
 
 // An array mapping syscall numbers from syscall.h
 // to the function that handles the system call.
@@ -126,6 +142,20 @@ static uint64 (*syscalls[])(void) = {
 [SYS_link]    sys_link,
 [SYS_mkdir]   sys_mkdir,
 [SYS_close]   sys_close,
+[SYS_mmap]    sys_mmap,
+[SYS_munmap]  sys_munmap,
+[SYS_readv]   sys_readv,
+[SYS_writev]  sys_writev,
+[SYS_pread]   sys_pread,
+[SYS_pwrite]  sys_pwrite,
+[SYS_nice]    sys_nice,
+[SYS_clock_gettime] sys_clock_gettime,
+[SYS_nanosleep] sys_nanosleep,
+[SYS_clone]   sys_clone,
+[SYS_join]    sys_join,
+[SYS_futexwait] sys_futexwait,
+[SYS_futexwake] sys_futexwake,
+[SYS_getrusage] sys_getrusage,
 };
 
 void
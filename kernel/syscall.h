@@ -20,3 +20,17 @@
 #define SYS_link   19
 #define SYS_mkdir  20
 #define SYS_close  21
+#define SYS_mmap   22
+#define SYS_munmap 23
+#define SYS_readv  24
+#define SYS_writev 25
+#define SYS_pread  26
+#define SYS_pwrite 27
+#define SYS_nice   28
+#define SYS_clock_gettime 29
+#define SYS_nanosleep 30
+#define SYS_clone  31
+#define SYS_join   32
+#define SYS_futexwait 33
+#define SYS_futexwake 34
+#define SYS_getrusage 35
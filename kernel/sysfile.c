@@ -10,11 +10,14 @@
 #include "param.h"
 #include "stat.h"
 #include "spinlock.h"
+#include "sleeplock.h"
+#include "rusage.h"
 #include "proc.h"
 #include "fs.h"
-#include "sleeplock.h"
+#include "rcu.h"
 #include "file.h"
 #include "fcntl.h"
+#include "uio.h"
 
 // Fetch the nth word-sized system call argument as a file descriptor
 // and return both the descriptor and the corresponding struct file.
@@ -76,6 +79,7 @@ sys_read(void)
   argint(2, &n);
   if(argfd(0, 0, &f) < 0)
     return -1;
+  mmapprefault(p, n);
   return fileread(f, p, n);
 }
 
@@ -90,10 +94,99 @@ sys_write(void)
   argint(2, &n);
   if(argfd(0, 0, &f) < 0)
     return -1;
+  mmapprefault(p, n);
 
   return filewrite(f, p, n);
 }
 
+// Fetch the nth system call argument as a user array of iovcnt
+// iovecs, copying it into iov.
+static int
+argiov(int n, struct iovec *iov, int iovcnt)
+{
+  uint64 uiov, tot = 0;
+  int i;
+
+  argaddr(n, &uiov);
+  if(iovcnt < 0 || iovcnt > MAXIOV)
+    return -1;
+  if(copyin(myproc()->pagetable, (char*)iov, uiov, iovcnt*sizeof(struct iovec)) < 0)
+    return -1;
+  for(i = 0; i < iovcnt; i++){
+    tot += iov[i].iov_len;
+    if(iov[i].iov_len > 0x7fffffff || tot > 0x7fffffff)
+      return -1;
+    mmapprefault((uint64)iov[i].iov_base, iov[i].iov_len);
+  }
+  return 0;
+}
+
+uint64
+sys_readv(void)
+{
+  struct file *f;
+  struct iovec iov[MAXIOV];
+  int iovcnt;
+
+  argint(2, &iovcnt);
+  if(argfd(0, 0, &f) < 0 || argiov(1, iov, iovcnt) < 0)
+    return -1;
+  return filereadv(f, iov, iovcnt, -1);
+}
+
+uint64
+sys_writev(void)
+{
+  struct file *f;
+  struct iovec iov[MAXIOV];
+  int iovcnt;
+
+  argint(2, &iovcnt);
+  if(argfd(0, 0, &f) < 0 || argiov(1, iov, iovcnt) < 0)
+    return -1;
+  return filewritev(f, iov, iovcnt, -1);
+}
+
+// Read at an explicit offset, leaving the file offset alone.
+uint64
+sys_pread(void)
+{
+  struct file *f;
+  struct iovec iov;
+  int n, off;
+  uint64 p;
+
+  argaddr(1, &p);
+  argint(2, &n);
+  argint(3, &off);
+  if(argfd(0, 0, &f) < 0 || n < 0 || off < 0)
+    return -1;
+  mmapprefault(p, n);
+  iov.iov_base = (void*)p;
+  iov.iov_len = n;
+  return filereadv(f, &iov, 1, off);
+}
+
+// Write at an explicit offset, leaving the file offset alone.
+uint64
+sys_pwrite(void)
+{
+  struct file *f;
+  struct iovec iov;
+  int n, off;
+  uint64 p;
+
+  argaddr(1, &p);
+  argint(2, &n);
+  argint(3, &off);
+  if(argfd(0, 0, &f) < 0 || n < 0 || off < 0)
+    return -1;
+  mmapprefault(p, n);
+  iov.iov_base = (void*)p;
+  iov.iov_len = n;
+  return filewritev(f, &iov, 1, off);
+}
+
 uint64
 sys_close(void)
 {
@@ -503,3 +596,29 @@ sys_pipe(void)
   }
   return 0;
 }
+
+uint64
+sys_mmap(void)
+{
+  uint64 len;
+  int prot, flags, off;
+  struct file *f;
+
+  argaddr(1, &len);
+  argint(2, &prot);
+  argint(3, &flags);
+  argint(5, &off);
+  if(off < 0 || argfd(4, 0, &f) < 0)
+    return -1;
+  return mmap(len, prot, flags, f, off);
+}
+
+uint64
+sys_munmap(void)
+{
+  uint64 addr, len;
+
+  argaddr(0, &addr);
+  argaddr(1, &len);
+  return munmap(addr, len);
+}
@@ -4,7 +4,10 @@
 #include "param.h"
 #include "memlayout.h"
 #include "spinlock.h"
+#include "sleeplock.h"
+#include "rusage.h"
 #include "proc.h"
+#include "time.h"
 
 uint64
 sys_exit(void)
@@ -35,6 +38,63 @@ sys_wait(void)
   return wait(p);
 }
 
+uint64
+sys_clone(void)
+{
+  uint64 fn, arg, stack;
+
+  argaddr(0, &fn);
+  argaddr(1, &arg);
+  argaddr(2, &stack);
+  if(stack % 16 != 0)
+    return -1;
+  return clone(fn, arg, stack);
+}
+
+uint64
+sys_join(void)
+{
+  int tid;
+  uint64 p;
+
+  argint(0, &tid);
+  argaddr(1, &p);
+  return join(tid, p);
+}
+
+uint64
+sys_futexwait(void)
+{
+  uint64 addr;
+  int val;
+
+  argaddr(0, &addr);
+  argint(1, &val);
+  return futexwait(addr, val);
+}
+
+uint64
+sys_futexwake(void)
+{
+  uint64 addr;
+  int n;
+
+  argaddr(0, &addr);
+  argint(1, &n);
+  return futexwake(addr, n);
+}
+
+uint64
+sys_getrusage(void)
+{
+  int who;
+  uint64 addr;
+
+  argint(0, &who);
+  argaddr(1, &addr);
+  return getrusage(who, addr);
+}
+
 uint64
 sys_sbrk(void)
 {
@@ -42,8 +102,7 @@ sys_sbrk(void)
   int n;
 
   argint(0, &n);
-  addr = myproc()->sz;
-  if(growproc(n) < 0)
+  if((addr = growproc(n)) == -1)
     return -1;
   return addr;
 }
@@ -52,22 +111,9 @@ uint64
 sys_sleep(void)
 {
   int n;
-  uint ticks0;
 
   argint(0, &n);
-  if(n < 0)
-    n = 0;
-  acquire(&tickslock);
-  ticks0 = ticks;
-  while(ticks - ticks0 < n){
-    if(killed(myproc())){
-      release(&tickslock);
-      return -1;
-    }
-    sleep(&ticks, &tickslock);
-  }
-  release(&tickslock);
-  return 0;
+  return sleepticks(n);
 }
 
 uint64
@@ -79,15 +125,75 @@ sys_kill(void)
   return kill(pid);
 }
 
-// return how many clock tick interrupts have occurred
+// return how many clock ticks have gone by
 // since start.
 uint64
 sys_uptime(void)
 {
-  uint xticks;
+  return uptime();
+}
+
+uint64
+sys_nice(void)
+{
+  int incr;
+
+  argint(0, &incr);
+  return nice(incr);
+}
+
+// Convert between time CSR cycles and a struct timespec.
+static void
+cycles2ts(uint64 cycles, struct timespec *ts)
+{
+  ts->tv_sec = cycles / TIMEBASE;
+  ts->tv_nsec = (cycles % TIMEBASE) * NSEC / TIMEBASE;
+}
+
+static uint64
+ts2cycles(struct timespec *ts)
+{
+  return ts->tv_sec * TIMEBASE + (ts->tv_nsec * TIMEBASE + NSEC - 1) / NSEC;
+}
 
-  acquire(&tickslock);
-  xticks = ticks;
-  release(&tickslock);
-  return xticks;
+uint64
+sys_clock_gettime(void)
+{
+  int clk;
+  uint64 addr;
+  struct timespec ts;
+
+  argint(0, &clk);
+  argaddr(1, &addr);
+  if(clk != CLOCK_MONOTONIC)
+    return -1;
+  cycles2ts(r_time(), &ts);
+  if(copyout(myproc()->pagetable, addr, (char*)&ts, sizeof(ts)) < 0)
+    return -1;
+  return 0;
+}
+
+// Sleep for the time in *req, to within a cycle of the time CSR.
+// If killed, store the time left in *rem, unless rem is 0.
+uint64
+sys_nanosleep(void)
+{
+  uint64 req, rem, when, now;
+  struct timespec ts;
+  struct proc *p = myproc();
+
+  argaddr(0, &req);
+  argaddr(1, &rem);
+  if(copyin(p->pagetable, (char*)&ts, req, sizeof(ts)) < 0)
+    return -1;
+  if(ts.tv_nsec >= NSEC || ts.tv_sec > 0xffffffff)
+    return -1;
+  when = r_time() + ts2cycles(&ts);
+  if(sleepuntil(when) == 0)
+    return 0;
+  now = r_time();
+  cycles2ts(when > now ? when - now : 0, &ts);
+  if(rem != 0)
+    copyout(p->pagetable, rem, (char*)&ts, sizeof(ts));
+  return -1;
 }
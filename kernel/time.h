@@ -0,0 +1,8 @@
+#define CLOCK_MONOTONIC 1  // time since boot
+
+struct timespec {
+  uint64 tv_sec;   // seconds
+  uint64 tv_nsec;  // nanoseconds, less than NSEC
+};
+
+#define NSEC 1000000000L  // nanoseconds per second
@@ -0,0 +1,270 @@
+//
+// Timer interrupts and sleep() timeouts.
+//
+// A hart's timer interrupt normally comes once a tick, so that
+// the running process can be preempted.  A hart with nothing
+// else to run -- idle, or running the only process it has --
+// instead asks for its next interrupt when the next timeout
+// expires, or after IDLETICKS ticks at most.  The harts can't
+// interrupt one another, so setrunnable() (proc.c) queues a
+// process on a hart that isn't taking ticks only if it's the
+// hart doing the queueing.
+//
+// A process in sleep(n) waits on a timeout in a timer wheel of
+// NWHEEL slots, indexed by the tick at which it expires, so
+// that a timer interrupt looks only at the slots of the ticks
+// that have gone by since the last one.
+//
+// A process in nanosleep() waits instead on an hrtimer in hrq,
+// a list sorted by expiry time, to the cycle of the time CSR.
+// The hart's next timer interrupt is set for the earliest of
+// the next tick it needs, the next timeout, and the head of hrq.
+//
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "rusage.h"
+#include "proc.h"
+#include "defs.h"
+
+#define NWHEEL 64
+
+struct timeout {
+  uint64 expires;          // tick at which to wake up
+  int queued;              // still waiting on the wheel?
+  struct timeout *next;    // next in wheel slot
+};
+
+struct hrtimer {
+  uint64 expires;          // time CSR value at which to wake up
+  int queued;              // still waiting on hrq?
+  struct hrtimer *next;    // next to expire
+};
+
+// tickslock must be held when using these.
+struct hrtimer *hrq;
+uint64 hrnext = ~0;        // hrq's first expiry; read without the lock
+struct {
+  struct timeout *slot[NWHEEL];
+  uint64 done;             // ticks up to here have been handled
+  int pending;             // number of timeouts on the wheel
+  uint64 next;             // no timeout expires before this tick
+} wheel;
+
+// Note the new head of hrq, for settimer() and clockintr()
+// on harts that don't hold tickslock.
+// Caller must hold tickslock.
+static void
+hrqchanged(void)
+{
+  __atomic_store_n(&hrnext, hrq ? hrq->expires : ~0UL, __ATOMIC_RELEASE);
+}
+
+// Return the current tick.
+static uint64
+curtick(void)
+{
+  return r_time() / TICKCYCLES;
+}
+
+// Make sure this hart's next timer interrupt comes no later
+// than time when.
+// Caller must have interrupts off.
+void
+timerby(uint64 when)
+{
+  struct cpu *c = mycpu();
+
+  acquire(&c->runq.lock);
+  if(when < c->nexttimer){
+    c->nexttimer = when;
+    w_stimecmp(when);
+  }
+  release(&c->runq.lock);
+}
+
+// Ask for this hart's next timer interrupt: in a tick if
+// another process is waiting to run here, so as to preempt
+// the current one, or if the current one is a thread, so that
+// tlbsync() needn't wait long for it; otherwise when the next
+// timeout expires, or after IDLETICKS ticks.  Reads the wheel's
+// counters and hrnext without tickslock, never hrq itself, whose
+// timers live on their sleepers' stacks; the hart that adds a
+// timeout makes sure its own timer interrupt comes in time for it.
+// Caller must have interrupts off.
+void
+settimer(void)
+{
+  struct cpu *c = mycpu();
+  uint64 next, hr;
+
+  acquire(&c->runq.lock);
+  if(c->runq.len > 0 || (c->proc && c->proc->mm->nthread > 0))
+    next = r_time() + TICKCYCLES;
+  else
+    next = r_time() + IDLETICKS * TICKCYCLES;
+  if(wheel.pending > 0 && wheel.next * TICKCYCLES < next)
+    next = wheel.next * TICKCYCLES;
+  if((hr = __atomic_load_n(&hrnext, __ATOMIC_ACQUIRE)) < next)
+    next = hr;
+  c->nexttimer = next;
+  w_stimecmp(next);
+  release(&c->runq.lock);
+}
+
+// Wake the timeouts that have expired by tick now.
+// Caller must hold tickslock.
+static void
+runwheel(uint64 now)
+{
+  struct timeout *t, **tp;
+  uint64 n, i;
+
+  n = now - wheel.done;
+  if(n > NWHEEL)
+    n = NWHEEL;
+  for(i = 1; i <= n; i++){
+    for(tp = &wheel.slot[(wheel.done + i) % NWHEEL]; (t = *tp) != 0; ){
+      if(t->expires <= now){
+        *tp = t->next;
+        t->queued = 0;
+        wheel.pending--;
+        wakeup(t);
+      } else {
+        tp = &t->next;
+      }
+    }
+  }
+  wheel.done = now;
+
+  if(wheel.pending > 0 && wheel.next <= now){
+    wheel.next = ~0;
+    for(i = 0; i < NWHEEL; i++)
+      for(t = wheel.slot[i]; t; t = t->next)
+        if(t->expires < wheel.next)
+          wheel.next = t->expires;
+  }
+}
+
+// Wake the hrtimers that have expired by time now.
+// Caller must hold tickslock.
+static void
+runhrq(uint64 now)
+{
+  struct hrtimer *t;
+
+  while((t = hrq) != 0 && t->expires <= now){
+    hrq = t->next;
+    t->queued = 0;
+    wakeup(t);
+  }
+  hrqchanged();
+}
+
+void
+clockintr()
+{
+  uint64 now = r_time();
+  uint64 tick = now / TICKCYCLES;
+
+  mycpu()->ntimer++;
+
+  if(wheel.done != tick || __atomic_load_n(&hrnext, __ATOMIC_ACQUIRE) <= now){
+    acquire(&tickslock);
+    if(tick > wheel.done)
+      runwheel(tick);
+    runhrq(now);
+    ticks = tick;
+    release(&tickslock);
+  }
+
+  // ask for the next timer interrupt. this also clears
+  // the interrupt request.
+  settimer();
+}
+
+// Return the number of ticks since boot.
+uint
+uptime(void)
+{
+  uint xticks;
+
+  acquire(&tickslock);
+  xticks = ticks = curtick();
+  release(&tickslock);
+  return xticks;
+}
+
+// Sleep for n ticks.
+// Returns 0, or -1 if the process was killed.
+int
+sleepticks(int n)
+{
+  struct timeout t, **tp;
+
+  if(n <= 0)
+    return 0;
+
+  acquire(&tickslock);
+  t.expires = curtick() + n;
+  t.queued = 1;
+  t.next = wheel.slot[t.expires % NWHEEL];
+  wheel.slot[t.expires % NWHEEL] = &t;
+  if(wheel.pending++ == 0 || t.expires < wheel.next)
+    wheel.next = t.expires;
+  timerby(t.expires * TICKCYCLES);
+
+  while(t.queued){
+    if(killed(myproc())){
+      for(tp = &wheel.slot[t.expires % NWHEEL]; *tp != &t; tp = &(*tp)->next)
+        ;
+      *tp = t.next;
+      wheel.pending--;
+      release(&tickslock);
+      return -1;
+    }
+    sleep(&t, &tickslock);
+  }
+  release(&tickslock);
+  return 0;
+}
+
+// Sleep until the time CSR reaches when.
+// Returns 0, or -1 if the process was killed.
+int
+sleepuntil(uint64 when)
+{
+  struct hrtimer t, **tp;
+
+  acquire(&tickslock);
+  if(when <= r_time()){
+    release(&tickslock);
+    return 0;
+  }
+  t.expires = when;
+  t.queued = 1;
+  for(tp = &hrq; *tp && (*tp)->expires <= when; tp = &(*tp)->next)
+    ;
+  t.next = *tp;
+  *tp = &t;
+  hrqchanged();
+  timerby(when);
+
+  while(t.queued){
+    if(killed(myproc())){
+      for(tp = &hrq; *tp != &t; tp = &(*tp)->next)
+        ;
+      *tp = t.next;
+      hrqchanged();
+      release(&tickslock);
+      return -1;
+    }
+    sleep(&t, &tickslock);
+  }
+  release(&tickslock);
+  return 0;
+}
@@ -3,7 +3,10 @@
 #include "memlayout.h"
 #include "riscv.h"
 #include "spinlock.h"
+#include "sleeplock.h"
+#include "rusage.h"
 #include "proc.h"
+#include "fcntl.h"
 #include "defs.h"
 
 struct spinlock tickslock;
@@ -45,7 +48,18 @@ usertrap(void)
   // since we're now in the kernel.
   w_stvec((uint64)kernelvec);
 
+  // uservec flushed this hart's TLB; see tlbsync().
+  mycpu()->utraps++;
+
+  // user code holds no RCU read section.
+  rcu_quiesce();
+
   struct proc *p = myproc();
+  uint64 now = r_time();
+
+  // charge the time since usertrapret() to user mode.
+  p->ru.ru_utime += now - p->rustamp;
+  p->rustamp = now;
   
   // save user program counter.
   p->trapframe->epc = r_sepc();
@@ -78,7 +92,7 @@ usertrap(void)
 
   // give up the CPU if this is a timer interrupt.
   if(which_dev == 2)
-    yield();
+    preempt();
 
   usertrapret();
 }
@@ -90,12 +104,18 @@ void
 usertrapret(void)
 {
   struct proc *p = myproc();
+  uint64 now;
 
   // we're about to switch the destination of traps from
   // kerneltrap() to usertrap(), so turn off interrupts until
   // we're back in user space, where usertrap() is correct.
   intr_off();
 
+  // charge the time since usertrap() or scheduler() to the kernel.
+  now = r_time();
+  p->ru.ru_stime += now - p->rustamp;
+  p->rustamp = now;
+
   // send syscalls, interrupts, and exceptions to uservec in trampoline.S
   uint64 trampoline_uservec = TRAMPOLINE + (uservec - trampoline);
   w_stvec(trampoline_uservec);
@@ -126,7 +146,7 @@ usertrapret(void)
   // switches to the user page table, restores user registers,
   // and switches to user mode with sret.
   uint64 trampoline_userret = TRAMPOLINE + (userret - trampoline);
-  ((void (*)(uint64))trampoline_userret)(satp);
+  ((void (*)(uint64, uint64))trampoline_userret)(satp, THREADFRAME(p->tslot));
 }
 
 // interrupts and exceptions from kernel code go here via kernelvec,
@@ -152,7 +172,7 @@ kerneltrap()
 
   // give up the CPU if this is a timer interrupt.
   if(which_dev == 2 && myproc() != 0)
-    yield();
+    preempt();
 
   // the yield() may have caused some traps to occur,
   // so restore trap registers for use by kernelvec.S's sepc instruction.
@@ -160,22 +180,6 @@ kerneltrap()
   w_sstatus(sstatus);
 }
 
-void
-clockintr()
-{
-  if(cpuid() == 0){
-    acquire(&tickslock);
-    ticks++;
-    wakeup(&ticks);
-    release(&tickslock);
-  }
-
-  // ask for the next timer interrupt. this also clears
-  // the interrupt request. 1000000 is about a tenth
-  // of a second.
-  w_stimecmp(r_time() + 1000000);
-}
-
 int
 storepagefault()
 {
@@ -187,13 +191,20 @@ storepagefault()
     return 3;
   }
 
-  // Get the PTE for the faulting address
+  // Get the PTE for the faulting address,
+  // filling in an untouched page of an mmap()ed region.
   pte_t *pte = walk(p->pagetable, va, 0);
+  if((pte == 0 || (*pte & PTE_V) == 0) && mmapfault(va, PROT_WRITE) == 0)
+    pte = walk(p->pagetable, va, 0);
   if(pte == 0){
     p->killed = 1;
     return 3;
   }
 
+  // A MAP_SHARED page, writable as soon as it's mapped.
+  if((*pte & PTE_V) && (*pte & PTE_W))
+    return 3;
+
   // Check if this was originally writable (COW page)
   if((*pte & PTE_V) && (*pte & PTE_ORGW)) {
     // Allocate new page
@@ -212,6 +223,7 @@ storepagefault()
     // Map the new page with write permission
     uint64 flags = (PTE_FLAGS(*pte) | PTE_W) & ~PTE_ORGW;
     *pte = PA2PTE((uint64)mem) | flags;
+    p->ru.ru_cowflt++;
 
     return 3;
   }
@@ -260,8 +272,11 @@ devintr()
     // store page fault
     return storepagefault();
   } else if (scause == 0xd || scause == 0xc){
+    // load or instruction page fault; only valid
+    // for an untouched page of an mmap()ed region.
     struct proc *p = myproc();
-    p->killed = 1;
+    if(mmapfault(r_stval(), scause == 0xd ? PROT_READ : PROT_EXEC) < 0)
+      p->killed = 1;
     return 4;
   } else {
     return 0;
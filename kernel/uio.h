@@ -0,0 +1,5 @@
+// One buffer of a readv() or writev().
+struct iovec {
+  void *iov_base;  // Start of buffer
+  uint64 iov_len;  // Length in bytes
+};
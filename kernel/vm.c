@@ -4,6 +4,10 @@
 #include "elf.h"
 #include "riscv.h"
 #include "defs.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "rusage.h"
+#include "proc.h"
 #include "fs.h"
 
 /*
@@ -43,9 +47,9 @@ kvmmake(void)
   // the highest virtual address in the kernel.
   kvmmap(kpgtbl, TRAMPOLINE, (uint64)trampoline, PGSIZE, PTE_R | PTE_X);
 
-  // allocate and map a kernel stack for each process.
-  proc_mapstacks(kpgtbl);
-  
+  // process kernel stacks are mapped as they are allocated;
+  // see procgrow().
+
   return kpgtbl;
 }
 
@@ -93,9 +97,8 @@ walk(pagetable_t pagetable, uint64 va, int alloc)
     if(*pte & PTE_V) {
       pagetable = (pagetable_t)PTE2PA(*pte);
     } else {
-      if(!alloc || (pagetable = (pde_t*)kalloc()) == 0)
+      if(!alloc || (pagetable = (pde_t*)kzalloc()) == 0)
         return 0;
-      memset(pagetable, 0, PGSIZE);
       *pte = PA2PTE(pagetable) | PTE_V;
     }
   }
@@ -204,10 +207,9 @@ pagetable_t
 uvmcreate()
 {
   pagetable_t pagetable;
-  pagetable = (pagetable_t) kalloc();
+  pagetable = (pagetable_t) kzalloc();
   if(pagetable == 0)
     return 0;
-  memset(pagetable, 0, PGSIZE);
   return pagetable;
 }
 
@@ -221,8 +223,7 @@ uvmfirst(pagetable_t pagetable, uchar *src, uint sz)
 
   if(sz >= PGSIZE)
     panic("uvmfirst: more than a page");
-  mem = kalloc();
-  memset(mem, 0, PGSIZE);
+  mem = kzalloc();
   mappages(pagetable, 0, PGSIZE, (uint64)mem, PTE_W|PTE_R|PTE_X|PTE_U);
   memmove(mem, src, sz);
 }
@@ -240,12 +241,11 @@ uvmalloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz, int xperm)
 
   oldsz = PGROUNDUP(oldsz);
   for(a = oldsz; a < newsz; a += PGSIZE){
-    mem = kalloc();
+    mem = kzalloc();
     if(mem == 0){
       uvmdealloc(pagetable, a, oldsz);
       return 0;
     }
-    memset(mem, 0, PGSIZE);
     if(mappages(pagetable, a, PGSIZE, (uint64)mem, PTE_R|PTE_U|xperm) != 0){
       kfree(mem);
       uvmdealloc(pagetable, a, oldsz);
@@ -305,15 +305,17 @@ uvmfree(pagetable_t pagetable, uint64 sz)
 
 // Given a parent process's page table, copy
 // its memory into a child's page table.
-// Copies both the page table and the
+// If cow is set, the pages are shared copy-on-write;
+// otherwise copies both the page table and the
 // physical memory.
 // returns 0 on success, -1 on failure.
 // frees any allocated pages on failure.
 int
-uvmcopy(pagetable_t old, pagetable_t new, uint64 sz)
+uvmcopy(pagetable_t old, pagetable_t new, uint64 sz, int cow)
 {
   pte_t *pte;
   uint64 i, pa, flags;
+  char *mem;
 
   for(i = 0; i < sz; i += PGSIZE){
     if((pte = walk(old, i, 0)) == 0)
@@ -321,11 +323,22 @@ uvmcopy(pagetable_t old, pagetable_t new, uint64 sz)
     if((*pte & PTE_V) == 0)
       panic("uvmcopy: page not present");
     flags = PTE_FLAGS(*pte);
+    pa = PTE2PA(*pte);
+    if(!cow){
+      if((mem = kalloc()) == 0)
+        goto err;
+      memmove(mem, (char*)pa, PGSIZE);
+      if(mappages(new, i, PGSIZE, (uint64)mem, flags) != 0){
+        kfree(mem);
+        goto err;
+      }
+      continue;
+    }
+
     if(flags & PTE_W)
       flags |= PTE_ORGW;
     flags &= ~PTE_W;
 
-    pa = PTE2PA(*pte);
     *pte = PA2PTE(pa) | flags;
     if(mappages(new, i, PGSIZE, pa, flags) != 0){
       goto err;
@@ -339,6 +352,30 @@ uvmcopy(pagetable_t old, pagetable_t new, uint64 sz)
   return -1;
 }
 
+// Give the page table private, writable copies of the
+// copy-on-write pages in [va, va+len); pages not mapped are
+// skipped.  Returns 0, or -1 if out of memory.
+int
+uvmunshare(pagetable_t pagetable, uint64 va, uint64 len)
+{
+  uint64 a, pa;
+  pte_t *pte;
+  char *mem;
+
+  for(a = PGROUNDDOWN(va); a < va + len; a += PGSIZE){
+    pte = walk(pagetable, a, 0);
+    if(pte == 0 || (*pte & PTE_V) == 0 || (*pte & PTE_ORGW) == 0)
+      continue;
+    if((mem = kalloc()) == 0)
+      return -1;
+    pa = PTE2PA(*pte);
+    memmove(mem, (char*)pa, PGSIZE);
+    *pte = PA2PTE((uint64)mem) | ((PTE_FLAGS(*pte) | PTE_W) & ~PTE_ORGW);
+    kfree((void*)pa);
+  }
+  return 0;
+}
+
 // mark a PTE invalid for user access.
 // used by exec for the user stack guard page.
 void
@@ -352,6 +389,58 @@ uvmclear(pagetable_t pagetable, uint64 va)
   *pte &= ~PTE_U;
 }
 
+// Map the physical page pa copy-on-write at user address va,
+// in place of the page mapped there now, so that a read into
+// a page-aligned user buffer can share a kernel page instead
+// of copying it.  va must be a page the user could write.
+// Not for page tables shared by threads (see clone()).
+// Returns 0 on success, -1 if va is not such a page.
+int
+uvmshare(pagetable_t pagetable, uint64 va, uint64 pa)
+{
+  pte_t *pte;
+  uint64 flags;
+
+  if(va >= MAXVA || (va % PGSIZE) != 0)
+    return -1;
+  pte = walk(pagetable, va, 0);
+  if(pte == 0 || (*pte & PTE_V) == 0 || (*pte & PTE_U) == 0)
+    return -1;
+  if((*pte & (PTE_W|PTE_ORGW)) == 0)
+    return -1;
+
+  flags = (PTE_FLAGS(*pte) & ~PTE_W) | PTE_ORGW;
+  kpageinc((void*)pa);
+  kfree((void*)PTE2PA(*pte));
+  *pte = PA2PTE(pa) | flags;
+  return 0;
+}
+
+// Make the user page at va copy-on-write, so that the caller
+// can hold on to its contents without copying them even if the
+// user writes the page afterwards.  The stale writable TLB entry
+// goes away when the process next returns to user space.
+// Not for page tables shared by threads (see clone()).
+// Returns the page's physical address, with a reference for
+// the caller, or 0 if va is not a user page.
+uint64
+uvmdonate(pagetable_t pagetable, uint64 va)
+{
+  pte_t *pte;
+  uint64 pa;
+
+  if(va >= MAXVA || (va % PGSIZE) != 0)
+    return 0;
+  pte = walk(pagetable, va, 0);
+  if(pte == 0 || (*pte & PTE_V) == 0 || (*pte & PTE_U) == 0)
+    return 0;
+  if(*pte & PTE_W)
+    *pte = (*pte & ~PTE_W) | PTE_ORGW;
+  pa = PTE2PA(*pte);
+  kpageinc((void*)pa);
+  return pa;
+}
+
 // Copy from kernel to user.
 // Copy len bytes from src to virtual address dstva in a given page table.
 // Return 0 on success, -1 on error.
@@ -380,6 +469,7 @@ copyout(pagetable_t pagetable, uint64 dstva, char *src, uint64 len)
         uint64 flags = PTE_FLAGS(*pte);
         flags |= PTE_W;
         *pte = PA2PTE((uint64)mem) | flags;
+        myproc()->ru.ru_cowflt++;
       } else {
         return -1;
       }
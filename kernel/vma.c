@@ -0,0 +1,359 @@
+//
+// Memory-mapped files: mmap() and munmap().
+//
+// Each address space has a small table of regions, mm->vma[], placed
+// downward from MMAPTOP.  mmap() only records the region; pages
+// are filled in on demand by mmapfault(), called from the page
+// fault handlers in trap.c.  MAP_PRIVATE regions map pages of
+// the file page cache copy-on-write, so reading a mapped file
+// costs no copy and writing one goes through storepagefault().
+// MAP_SHARED regions get pages of their own, which are written
+// back to the file when they are unmapped.
+//
+// mm->lock protects the table and serializes changes to the
+// mappings, between the threads sharing an address space.
+//
+
+#include "types.h"
+#include "riscv.h"
+#include "defs.h"
+#include "param.h"
+#include "fs.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "rcu.h"
+#include "file.h"
+#include "rusage.h"
+#include "proc.h"
+#include "fcntl.h"
+#include "memlayout.h"
+
+static int vmafault(uint64, int);
+
+// Return the region of p containing va, or 0.
+static struct vma*
+vmalookup(struct proc *p, uint64 va)
+{
+  struct vma *v;
+
+  for(v = p->mm->vma; v < &p->mm->vma[NVMA]; v++){
+    if(v->addr && va >= v->addr && va < v->addr + v->len)
+      return v;
+  }
+  return 0;
+}
+
+// Return the lowest address mapped by mmap(),
+// which is as far as the heap may grow.
+// Caller must hold p->mm->lock.
+uint64
+mmapbase(struct proc *p)
+{
+  struct vma *v;
+  uint64 base = MMAPTOP;
+
+  for(v = p->mm->vma; v < &p->mm->vma[NVMA]; v++){
+    if(v->addr && v->addr < base)
+      base = v->addr;
+  }
+  return base;
+}
+
+// Map len bytes of f, starting at offset off, into the
+// current process.  Returns the address, or -1.
+uint64
+mmap(uint64 len, int prot, int flags, struct file *f, uint off)
+{
+  struct proc *p = myproc();
+  struct vma *v;
+  uint64 top;
+
+  if(len == 0 || off % PGSIZE != 0)
+    return -1;
+  if(flags != MAP_SHARED && flags != MAP_PRIVATE)
+    return -1;
+  if(f->type != FD_INODE || f->readable == 0)
+    return -1;
+  if(flags == MAP_SHARED && (prot & PROT_WRITE) && f->writable == 0)
+    return -1;
+
+  len = PGROUNDUP(len);
+  acquiresleep(&p->mm->lock);
+  top = mmapbase(p);
+  if(len > top || top - len < PGROUNDUP(p->mm->sz)){
+    releasesleep(&p->mm->lock);
+    return -1;
+  }
+
+  for(v = p->mm->vma; v < &p->mm->vma[NVMA]; v++){
+    if(v->addr == 0){
+      v->addr = top - len;
+      v->len = len;
+      v->prot = prot;
+      v->flags = flags;
+      v->f = filedup(f);
+      v->off = off;
+      releasesleep(&p->mm->lock);
+      return v->addr;
+    }
+  }
+  releasesleep(&p->mm->lock);
+  return -1;
+}
+
+// Fill in the page at va of one of the current process's
+// mapped regions, if the region allows access prot.
+// Returns 0 on success, -1 if va isn't mapped that way.
+int
+mmapfault(uint64 va, int prot)
+{
+  struct mm *mm = myproc()->mm;
+  int r;
+
+  acquiresleep(&mm->lock);
+  r = vmafault(va, prot);
+  releasesleep(&mm->lock);
+  return r;
+}
+
+// mmapfault(), with mm->lock held.
+static int
+vmafault(uint64 va, int prot)
+{
+  struct proc *p = myproc();
+  struct vma *v;
+  struct inode *ip;
+  pte_t *pte;
+  char *mem;
+  uint off;
+  int perm;
+
+  va = PGROUNDDOWN(va);
+  if((v = vmalookup(p, va)) == 0 || (v->prot & prot) != prot)
+    return -1;
+  if((pte = walk(p->pagetable, va, 0)) != 0 && (*pte & PTE_V))
+    return 0;
+
+  ip = v->f->ip;
+  off = v->off + (va - v->addr);
+  perm = PTE_U | PTE_R;
+  if(v->prot & PROT_EXEC)
+    perm |= PTE_X;
+
+  ilock(ip);
+  if(v->flags == MAP_PRIVATE && !(p->mm->nthread && (v->prot & PROT_WRITE)) &&
+     (mem = igetpage(ip, off)) != 0){
+    // share the cached page until the process writes to it.
+    if(v->prot & PROT_WRITE)
+      perm |= PTE_ORGW;
+    p->ru.ru_minflt++;
+  } else {
+    if((mem = kzalloc()) == 0){
+      iunlock(ip);
+      return -1;
+    }
+    if(readi(ip, 0, (uint64)mem, off, PGSIZE) < 0){
+      iunlock(ip);
+      kfree(mem);
+      return -1;
+    }
+    if(v->prot & PROT_WRITE)
+      perm |= PTE_W;
+    p->ru.ru_majflt++;
+  }
+  iunlock(ip);
+
+  if(mappages(p->pagetable, va, PGSIZE, (uint64)mem, perm) != 0){
+    kfree(mem);
+    return -1;
+  }
+  return 0;
+}
+
+// Fill in any mapped pages in [va, va+len) that haven't been
+// touched yet, so that a system call can copy to or from them
+// without taking a page fault.
+void
+mmapprefault(uint64 va, uint64 len)
+{
+  struct proc *p = myproc();
+  struct vma *v;
+  uint64 a, last;
+
+  if(va + len < va)
+    return;
+  acquiresleep(&p->mm->lock);
+  for(v = p->mm->vma; v < &p->mm->vma[NVMA]; v++){
+    if(v->addr == 0 || va >= v->addr + v->len || va + len <= v->addr)
+      continue;
+    a = PGROUNDDOWN(va > v->addr ? va : v->addr);
+    last = va + len < v->addr + v->len ? va + len : v->addr + v->len;
+    for(; a < last; a += PGSIZE)
+      vmafault(a, PROT_READ);
+  }
+  releasesleep(&p->mm->lock);
+}
+
+// Write the page at va of region v, held in physical page pa,
+// back to the file.  Doesn't grow the file.
+static void
+vmawriteback(struct vma *v, uint64 va, uint64 pa)
+{
+  struct inode *ip = v->f->ip;
+  uint off = v->off + (va - v->addr);
+  uint n;
+
+  begin_op();
+  ilock(ip);
+  if(off < ip->size){
+    n = ip->size - off;
+    if(n > PGSIZE)
+      n = PGSIZE;
+    writei(ip, 0, pa, off, n);
+  }
+  iunlock(ip);
+  end_op();
+}
+
+// Remove [addr, addr+len) of region v from p's page table,
+// writing pages of writable MAP_SHARED regions back first.
+// Caller must hold p->mm->lock.
+static void
+vmaunmap(struct proc *p, struct vma *v, uint64 addr, uint64 len)
+{
+  uint64 a;
+  pte_t *pte;
+
+  if(v->flags == MAP_SHARED && (v->prot & PROT_WRITE)){
+    for(a = addr; a < addr + len; a += PGSIZE){
+      if((pte = walk(p->pagetable, a, 0)) != 0 && (*pte & PTE_V))
+        vmawriteback(v, a, PTE2PA(*pte));
+    }
+  }
+  mmunmap(p, addr, len / PGSIZE);
+}
+
+// Unmap [addr, addr+len) of the current process.  The range
+// must lie within one region and include its start or end.
+// Returns 0 on success, -1 on error.
+int
+munmap(uint64 addr, uint64 len)
+{
+  struct proc *p = myproc();
+  struct vma *v;
+  struct file *f;
+
+  if(addr % PGSIZE != 0 || len == 0)
+    return -1;
+  len = PGROUNDUP(len);
+  acquiresleep(&p->mm->lock);
+  if((v = vmalookup(p, addr)) == 0 || addr + len < addr ||
+     addr + len > v->addr + v->len ||
+     (addr != v->addr && addr + len != v->addr + v->len)){
+    releasesleep(&p->mm->lock);
+    return -1;
+  }
+
+  vmaunmap(p, v, addr, len);
+  if(addr == v->addr){
+    v->addr += len;
+    v->off += len;
+  }
+  v->len -= len;
+  f = 0;
+  if(v->len == 0){
+    f = v->f;
+    v->addr = 0;
+    v->f = 0;
+  }
+  releasesleep(&p->mm->lock);
+  if(f)
+    fileclose(f);
+  return 0;
+}
+
+// Unmap all of p's regions, for exit() and exec().
+void
+munmapall(struct proc *p)
+{
+  struct vma *v;
+  struct file *f;
+
+  for(v = p->mm->vma; v < &p->mm->vma[NVMA]; v++){
+    if(v->addr == 0)
+      continue;
+    acquiresleep(&p->mm->lock);
+    vmaunmap(p, v, v->addr, v->len);
+    f = v->f;
+    v->addr = 0;
+    v->f = 0;
+    releasesleep(&p->mm->lock);
+    fileclose(f);
+  }
+}
+
+// Give child np copies of p's regions, for fork().
+// Pages already present are shared: copy-on-write for
+// MAP_PRIVATE regions, and writable by both processes for
+// MAP_SHARED ones.  But if threads share p's address space,
+// it can't have copy-on-write pages (see clone()), so
+// np gets copies of writable MAP_PRIVATE pages instead.
+// Doesn't sleep.  Caller must hold p->mm->lock.
+// Returns 0 on success, -1 on failure, having undone
+// any partial copy.
+int
+mmapcopy(struct proc *p, struct proc *np)
+{
+  struct vma *v;
+  pte_t *pte;
+  uint64 a, pa, flags;
+  char *mem;
+  int i;
+
+  for(i = 0; i < NVMA; i++){
+    v = &p->mm->vma[i];
+    if(v->addr == 0)
+      continue;
+    for(a = v->addr; a < v->addr + v->len; a += PGSIZE){
+      if((pte = walk(p->pagetable, a, 0)) == 0 || (*pte & PTE_V) == 0)
+        continue;
+      flags = PTE_FLAGS(*pte);
+      pa = PTE2PA(*pte);
+      if(v->flags == MAP_PRIVATE && (flags & PTE_W) && p->mm->nthread){
+        if((mem = kalloc()) == 0)
+          goto err;
+        memmove(mem, (char*)pa, PGSIZE);
+        if(mappages(np->pagetable, a, PGSIZE, (uint64)mem, flags) != 0){
+          kfree(mem);
+          goto err;
+        }
+        continue;
+      }
+      if(v->flags == MAP_PRIVATE && (flags & PTE_W)){
+        flags = (flags | PTE_ORGW) & ~PTE_W;
+        *pte = PA2PTE(pa) | flags;
+      }
+      if(mappages(np->pagetable, a, PGSIZE, pa, flags) != 0)
+        goto err;
+      kpageinc((void*)pa);
+    }
+  }
+
+  for(i = 0; i < NVMA; i++){
+    np->mm->vma[i] = p->mm->vma[i];
+    if(np->mm->vma[i].addr)
+      filedup(np->mm->vma[i].f);
+  }
+  return 0;
+
+ err:
+  for(v = p->mm->vma; v < &p->mm->vma[NVMA]; v++){
+    if(v->addr == 0)
+      continue;
+    for(a = v->addr; a < v->addr + v->len; a += PGSIZE){
+      if((pte = walk(np->pagetable, a, 0)) != 0 && (*pte & PTE_V))
+        uvmunmap(np->pagetable, a, 1, 1);
+    }
+  }
+  return -1;
+}
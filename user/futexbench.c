@@ -0,0 +1,177 @@
+// futexbench: N threads (default 4) take turns holding a lock
+// for a second, first a spin lock and then a futex-based mutex,
+// and print how many times each kind was acquired and how fairly
+// the threads shared it.  Then two threads hand a token back and
+// forth for a second, with a mutex and condition variable and
+// then with a pair of pipes, and print the round trips made.
+
+#include "kernel/types.h"
+#include "kernel/param.h"
+#include "kernel/memlayout.h"
+#include "kernel/riscv.h"
+#include "user/user.h"
+
+#define MAXTHREAD 15
+
+static inline uint64
+rdtime(void)
+{
+  uint64 x;
+  asm volatile("rdtime %0" : "=r" (x));
+  return x;
+}
+
+static uint64 start, end;
+static uint64 rounds[MAXTHREAD];
+static volatile uint64 shared;  // what the lock protects
+static int spin;
+static struct mutex mu;
+static int usemutex;
+
+void
+locker(void *arg)
+{
+  int i = (uint64)arg;
+  uint64 n = 0;
+
+  while(rdtime() < start)
+    ;
+  while(rdtime() < end){
+    if(usemutex)
+      mutex_lock(&mu);
+    else
+      while(__sync_lock_test_and_set(&spin, 1) != 0)
+        ;
+    shared++;
+    if(usemutex)
+      mutex_unlock(&mu);
+    else
+      __sync_lock_release(&spin);
+    n++;
+  }
+  rounds[i] = n;
+}
+
+void
+lockrun(char *name, int nthread)
+{
+  int tids[MAXTHREAD], i;
+  uint64 total = 0, min = ~0, max = 0;
+
+  shared = 0;
+  start = rdtime() + TIMEBASE / 10;
+  end = start + TIMEBASE;
+  for(i = 0; i < nthread; i++){
+    if((tids[i] = thread_create(locker, (void*)(uint64)i)) < 0){
+      printf("futexbench: thread_create failed\n");
+      exit(1);
+    }
+  }
+  for(i = 0; i < nthread; i++){
+    thread_join(tids[i], 0);
+    total += rounds[i];
+    if(rounds[i] < min)
+      min = rounds[i];
+    if(rounds[i] > max)
+      max = rounds[i];
+  }
+  if(shared != total){
+    printf("futexbench: %s lost updates\n", name);
+    exit(1);
+  }
+  printf("%s: %d acquisitions/s; slowest thread got %d%% of the fastest's\n",
+         name, (int)total, max ? (int)(min * 100 / max) : 0);
+}
+
+static struct cond cv;
+static int token;   // whose turn it is, 0 or 1
+static int pingfds[2], pongfds[2];
+
+void
+condplayer(void *arg)
+{
+  int me = (uint64)arg;
+  uint64 n = 0;
+
+  mutex_lock(&mu);
+  while(rdtime() < end){
+    while(token != me)
+      cond_wait(&cv, &mu);
+    token = !me;
+    cond_broadcast(&cv);
+    n++;
+  }
+  // let the other player see the end.
+  token = !me;
+  cond_broadcast(&cv);
+  mutex_unlock(&mu);
+  rounds[me] = n;
+}
+
+void
+pipeplayer(void *arg)
+{
+  int me = (uint64)arg;
+  int in = me ? pingfds[0] : pongfds[0];
+  int out = me ? pongfds[1] : pingfds[1];
+  uint64 n = 0;
+  char c = 0;
+
+  if(me == 0)
+    write(out, &c, 1);
+  while(read(in, &c, 1) == 1){
+    if(rdtime() >= end)
+      c = 1;
+    write(out, &c, 1);
+    n++;
+    if(c)
+      break;
+  }
+  rounds[me] = n;
+}
+
+void
+pingpong(char *name, void (*fn)(void*))
+{
+  int tids[2], i;
+
+  end = rdtime() + TIMEBASE;
+  for(i = 0; i < 2; i++){
+    if((tids[i] = thread_create(fn, (void*)(uint64)i)) < 0){
+      printf("futexbench: thread_create failed\n");
+      exit(1);
+    }
+  }
+  for(i = 0; i < 2; i++)
+    thread_join(tids[i], 0);
+  printf("%s: %d round trips/s\n", name, (int)(rounds[0] < rounds[1] ? rounds[0] : rounds[1]));
+}
+
+int
+main(int argc, char *argv[])
+{
+  int nthread = 4;
+
+  if(argc > 1)
+    nthread = atoi(argv[1]);
+  if(nthread < 1 || nthread > MAXTHREAD){
+    fprintf(2, "usage: futexbench [nthread <= %d]\n", MAXTHREAD);
+    exit(1);
+  }
+
+  mutex_init(&mu);
+  usemutex = 0;
+  lockrun("spin lock", nthread);
+  usemutex = 1;
+  lockrun("futex mutex", nthread);
+
+  cond_init(&cv);
+  token = 0;
+  pingpong("mutex+cond", condplayer);
+  if(pipe(pingfds) < 0 || pipe(pongfds) < 0){
+    printf("futexbench: pipe failed\n");
+    exit(1);
+  }
+  pingpong("pipes", pipeplayer);
+  exit(0);
+}
@@ -0,0 +1,149 @@
+// lockbench: N processes (default 3, one per qemu CPU) each
+// allocate and free a page with sbrk() as fast as they can for
+// a second, keeping the kernel's kmem lock busy.  Prints how
+// many rounds each process managed, which shows how fairly the
+// lock is shared, the distribution of the time a round took,
+// and the kernel's counters for the kmem lock.
+
+#include "kernel/types.h"
+#include "kernel/param.h"
+#include "kernel/memlayout.h"
+#include "kernel/riscv.h"
+#include "user/user.h"
+
+#define MAXPROC 16
+#define NBUCKET 32   // round times, by power of two of time CSR cycles
+
+struct result {
+  uint64 rounds;
+  uint64 hist[NBUCKET];
+};
+
+static inline uint64
+rdtime(void)
+{
+  uint64 x;
+  asm volatile("rdtime %0" : "=r" (x));
+  return x;
+}
+
+void
+worker(int fd, uint64 start, uint64 end)
+{
+  struct result r;
+  uint64 t0, t1, d;
+  int b;
+
+  memset(&r, 0, sizeof(r));
+  while(rdtime() < start)
+    ;
+  for(t0 = rdtime(); t0 < end; t0 = t1){
+    if(sbrk(PGSIZE) == (char*)-1 || sbrk(-PGSIZE) == (char*)-1){
+      printf("lockbench: sbrk failed\n");
+      exit(1);
+    }
+    t1 = rdtime();
+    for(d = t1 - t0, b = 0; d > 1 && b < NBUCKET-1; d >>= 1)
+      b++;
+    r.hist[b]++;
+    r.rounds++;
+  }
+  write(fd, &r, sizeof(r));
+  exit(0);
+}
+
+// Return the time, in microseconds, under which frac/1000
+// of the rounds in hist finished.
+int
+percentile(uint64 *hist, uint64 total, int frac)
+{
+  uint64 n = 0;
+  int b;
+
+  for(b = 0; b < NBUCKET; b++){
+    n += hist[b];
+    if(n * 1000 >= total * frac)
+      break;
+  }
+  return (int)((2L << b) * 1000000 / TIMEBASE);
+}
+
+// Print the lines of the statistics device about the kmem lock.
+void
+kmemstats(void)
+{
+  static char buf[4096];
+  char *p, *q;
+  int n;
+
+  n = statistics(buf, sizeof(buf)-1);
+  buf[n] = 0;
+  for(p = buf; p < buf + n; p = q + 1){
+    if((q = strchr(p, '\n')) == 0)
+      break;
+    if(memcmp(p, "lock kmem ", 10) == 0){
+      *q = 0;
+      printf("%s\n", p);
+    }
+  }
+}
+
+int
+main(int argc, char *argv[])
+{
+  int fds[2], i, nproc = 3;
+  uint64 start, total = 0, min = ~0, max = 0;
+  struct result r, all;
+
+  if(argc > 1)
+    nproc = atoi(argv[1]);
+  if(nproc < 1 || nproc > MAXPROC){
+    fprintf(2, "usage: lockbench [nproc <= %d]\n", MAXPROC);
+    exit(1);
+  }
+  if(pipe(fds) < 0){
+    printf("lockbench: pipe failed\n");
+    exit(1);
+  }
+
+  // start everyone together, once they have all been forked.
+  start = rdtime() + TIMEBASE / 10;
+  for(i = 0; i < nproc; i++){
+    int pid = fork();
+    if(pid < 0){
+      printf("lockbench: fork failed\n");
+      exit(1);
+    }
+    if(pid == 0){
+      close(fds[0]);
+      worker(fds[1], start, start + TIMEBASE);
+    }
+  }
+  close(fds[1]);
+
+  memset(&all, 0, sizeof(all));
+  for(i = 0; i < nproc; i++){
+    if(read(fds[0], &r, sizeof(r)) != sizeof(r)){
+      printf("lockbench: lost a result\n");
+      exit(1);
+    }
+    printf("process %d: %d rounds\n", i, (int)r.rounds);
+    total += r.rounds;
+    if(r.rounds < min)
+      min = r.rounds;
+    if(r.rounds > max)
+      max = r.rounds;
+    for(int b = 0; b < NBUCKET; b++)
+      all.hist[b] += r.hist[b];
+  }
+  for(i = 0; i < nproc; i++)
+    wait(0);
+
+  printf("%d rounds/s; slowest process got %d%% of the fastest's\n",
+         (int)total, max ? (int)(min * 100 / max) : 0);
+  printf("round time: p50 < %d us, p99 < %d us, p99.9 < %d us\n",
+         percentile(all.hist, total, 500), percentile(all.hist, total, 990),
+         percentile(all.hist, total, 999));
+  kmemstats();
+  exit(0);
+}
@@ -0,0 +1,184 @@
+// mallocbench: time malloc() and free() against the first-fit
+// allocator umalloc.c used to have, which is copied below as
+// kr_malloc() and kr_free().  Each of several workloads keeps a
+// set of live blocks and replaces a random one at each step,
+// and prints the time per malloc/free pair, how far each
+// allocator grew the heap, and how much of that it kept once
+// all the blocks were freed.
+
+#include "kernel/types.h"
+#include "kernel/param.h"
+#include "kernel/memlayout.h"
+#include "kernel/riscv.h"
+#include "user/user.h"
+
+#define NLIVE 1000     // live blocks
+#define NSTEP 50000    // malloc/free pairs per workload
+#define NELEM(x) (sizeof(x)/sizeof((x)[0]))
+
+static inline uint64
+rdtime(void)
+{
+  uint64 x;
+  asm volatile("rdtime %0" : "=r" (x));
+  return x;
+}
+
+// Memory allocator by Kernighan and Ritchie,
+// The C programming Language, 2nd ed.  Section 8.7.
+
+typedef long Align;
+
+union header {
+  struct {
+    union header *ptr;
+    uint size;
+  } s;
+  Align x;
+};
+
+typedef union header Header;
+
+static Header base;
+static Header *freep;
+
+void
+kr_free(void *ap)
+{
+  Header *bp, *p;
+
+  bp = (Header*)ap - 1;
+  for(p = freep; !(bp > p && bp < p->s.ptr); p = p->s.ptr)
+    if(p >= p->s.ptr && (bp > p || bp < p->s.ptr))
+      break;
+  if(bp + bp->s.size == p->s.ptr){
+    bp->s.size += p->s.ptr->s.size;
+    bp->s.ptr = p->s.ptr->s.ptr;
+  } else
+    bp->s.ptr = p->s.ptr;
+  if(p + p->s.size == bp){
+    p->s.size += bp->s.size;
+    p->s.ptr = bp->s.ptr;
+  } else
+    p->s.ptr = bp;
+  freep = p;
+}
+
+static Header*
+morecore(uint nu)
+{
+  char *p;
+  Header *hp;
+
+  if(nu < 4096)
+    nu = 4096;
+  p = sbrk(nu * sizeof(Header));
+  if(p == (char*)-1)
+    return 0;
+  hp = (Header*)p;
+  hp->s.size = nu;
+  kr_free((void*)(hp + 1));
+  return freep;
+}
+
+void*
+kr_malloc(uint nbytes)
+{
+  Header *p, *prevp;
+  uint nunits;
+
+  nunits = (nbytes + sizeof(Header) - 1)/sizeof(Header) + 1;
+  if((prevp = freep) == 0){
+    base.s.ptr = freep = prevp = &base;
+    base.s.size = 0;
+  }
+  for(p = prevp->s.ptr; ; prevp = p, p = p->s.ptr){
+    if(p->s.size >= nunits){
+      if(p->s.size == nunits)
+        prevp->s.ptr = p->s.ptr;
+      else {
+        p->s.size -= nunits;
+        p += p->s.size;
+        p->s.size = nunits;
+      }
+      freep = prevp;
+      return (void*)(p + 1);
+    }
+    if(p == freep)
+      if((p = morecore(nunits)) == 0)
+        return 0;
+  }
+}
+
+struct allocator {
+  char *name;
+  void *(*malloc)(uint);
+  void (*free)(void*);
+};
+
+struct workload {
+  char *name;
+  uint min, max;    // block sizes, chosen uniformly
+};
+
+static void *live[NLIVE];
+static uint64 seed;
+
+static uint
+rnd(void)
+{
+  seed = seed * 6364136223846793005UL + 1442695040888963407UL;
+  return seed >> 33;
+}
+
+void
+run(struct allocator *a, struct workload *w)
+{
+  uint64 t0, t1;
+  char *brk0, *brk1;
+  int i, j;
+
+  seed = 1;
+  brk0 = sbrk(0);
+  t0 = rdtime();
+  for(i = 0; i < NLIVE + NSTEP; i++){
+    j = i < NLIVE ? i : rnd() % NLIVE;
+    if(i >= NLIVE)
+      a->free(live[j]);
+    if((live[j] = a->malloc(w->min + rnd() % (w->max - w->min + 1))) == 0){
+      printf("mallocbench: %s: out of memory\n", a->name);
+      exit(1);
+    }
+    *(char*)live[j] = 1;
+  }
+  brk1 = sbrk(0);
+  for(i = 0; i < NLIVE; i++)
+    a->free(live[i]);
+  t1 = rdtime();
+  printf("  %s: %d ns per pair, heap grew %d KB and kept %d KB\n", a->name,
+         (int)((t1 - t0) * 1000000000 / TIMEBASE / (NLIVE + NSTEP)),
+         (int)((brk1 - brk0) / 1024), (int)((sbrk(0) - brk0) / 1024));
+}
+
+int
+main(int argc, char *argv[])
+{
+  static struct allocator allocators[] = {
+    { "first-fit", kr_malloc, kr_free },
+    { "size-class", malloc, free },
+  };
+  static struct workload workloads[] = {
+    { "small", 8, 128 },
+    { "mixed", 8, 2000 },
+    { "large", 2000, 16000 },
+  };
+  int i, j;
+
+  for(i = 0; i < NELEM(workloads); i++){
+    printf("%s blocks, %d to %d bytes:\n", workloads[i].name,
+           workloads[i].min, workloads[i].max);
+    for(j = 0; j < NELEM(allocators); j++)
+      run(&allocators[j], &workloads[i]);
+  }
+  exit(0);
+}
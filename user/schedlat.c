@@ -0,0 +1,99 @@
+// Measure how long a process woken up through a pipe waits
+// before it runs, while CPU-bound processes keep every CPU
+// busy: once at the default nice value, and once at the
+// highest priority.
+
+#include "kernel/types.h"
+#include "kernel/param.h"
+#include "kernel/time.h"
+#include "user/user.h"
+
+#define NBG   8     // CPU-bound background processes
+#define NWAKE 20    // wakeups to time
+
+// Return the time since boot in microseconds.
+static uint64
+usec(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// Time NWAKE wakeups of a process at nice value prio.
+void
+measure(int prio)
+{
+  int fds[2], i, pid;
+  uint64 t, lat, sum = 0, max = 0;
+
+  nice(prio);
+  if(pipe(fds) < 0){
+    printf("schedlat: pipe failed\n");
+    exit(1);
+  }
+  pid = fork();
+  if(pid < 0){
+    printf("schedlat: fork failed\n");
+    exit(1);
+  }
+  if(pid == 0){
+    // the waker: stamp the time just before each wakeup.
+    close(fds[0]);
+    for(i = 0; i < NWAKE; i++){
+      sleep(1);
+      t = usec();
+      write(fds[1], &t, sizeof(t));
+    }
+    exit(0);
+  }
+  close(fds[1]);
+  for(i = 0; i < NWAKE; i++){
+    if(read(fds[0], &t, sizeof(t)) != sizeof(t)){
+      printf("schedlat: read failed\n");
+      exit(1);
+    }
+    lat = usec() - t;
+    sum += lat;
+    if(lat > max)
+      max = lat;
+  }
+  wait(0);
+  printf("nice %d: wakeup latency avg %d us, max %d us\n",
+         prio, (int)(sum / NWAKE), (int)max);
+  exit(0);
+}
+
+int
+main(int argc, char *argv[])
+{
+  int bg[NBG], i, pid;
+  int prios[] = { 0, NICEMIN };
+
+  for(i = 0; i < NBG; i++){
+    if((bg[i] = fork()) < 0){
+      printf("schedlat: fork failed\n");
+      exit(1);
+    }
+    if(bg[i] == 0)
+      for(;;)
+        ;
+  }
+
+  for(i = 0; i < sizeof(prios)/sizeof(prios[0]); i++){
+    if((pid = fork()) < 0){
+      printf("schedlat: fork failed\n");
+      exit(1);
+    }
+    if(pid == 0)
+      measure(prios[i]);
+    wait(0);
+  }
+
+  for(i = 0; i < NBG; i++){
+    kill(bg[i]);
+    wait(0);
+  }
+  exit(0);
+}
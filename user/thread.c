@@ -0,0 +1,83 @@
+#include "kernel/types.h"
+#include "user/user.h"
+
+//
+// Threads.  thread_create() runs fn(arg) in a new thread on a
+// stack from malloc(), and the thread exits when fn returns;
+// thread_join() reaps it and frees the stack.  Any thread may
+// create or join threads.
+//
+
+#define TSTACK   8192  // bytes of stack per thread
+#define MAXTHREAD  16  // NTHREAD, less the first
+
+struct tstart {
+  void (*fn)(void*);
+  void *arg;
+};
+
+static struct {
+  int tid;
+  void *stack;  // 0 if free
+} threads[MAXTHREAD];
+static struct mutex lock;  // protects threads[]
+
+static void
+threadstart(void *a)
+{
+  struct tstart *t = a;
+
+  t->fn(t->arg);
+  exit(0);
+}
+
+int
+thread_create(void (*fn)(void*), void *arg)
+{
+  struct tstart *t;
+  char *stack;
+  int i, tid;
+
+  // hold lock until the thread is recorded, so that
+  // thread_join() can find it however soon it exits.
+  mutex_lock(&lock);
+  for(i = 0; i < MAXTHREAD && threads[i].stack; i++)
+    ;
+  if(i == MAXTHREAD || (stack = malloc(TSTACK)) == 0){
+    mutex_unlock(&lock);
+    return -1;
+  }
+  // fn and arg go at the top of the stack, which starts below them.
+  t = (struct tstart*)(stack + TSTACK) - 1;
+  t->fn = fn;
+  t->arg = arg;
+  if((tid = clone(threadstart, t, t)) < 0){
+    mutex_unlock(&lock);
+    free(stack);
+    return -1;
+  }
+  threads[i].tid = tid;
+  threads[i].stack = stack;
+  mutex_unlock(&lock);
+  return tid;
+}
+
+int
+thread_join(int tid, int *status)
+{
+  void *stack = 0;
+  int i;
+
+  if(join(tid, status) < 0)
+    return -1;
+  mutex_lock(&lock);
+  for(i = 0; i < MAXTHREAD; i++){
+    if(threads[i].stack && threads[i].tid == tid){
+      stack = threads[i].stack;
+      threads[i].stack = 0;
+    }
+  }
+  mutex_unlock(&lock);
+  free(stack);
+  return tid;
+}
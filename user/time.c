@@ -0,0 +1,55 @@
+// time: run a command, then print how long it took and
+// the resources it and its children used.
+
+#include "kernel/types.h"
+#include "kernel/time.h"
+#include "kernel/rusage.h"
+#include "user/user.h"
+
+// Return the time since boot in microseconds.
+static uint64
+usec(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+int
+main(int argc, char *argv[])
+{
+  struct rusage ru;
+  uint64 t0, t1;
+  int pid, xst;
+
+  if(argc < 2){
+    fprintf(2, "usage: time command [arg ...]\n");
+    exit(1);
+  }
+  t0 = usec();
+  pid = fork();
+  if(pid < 0){
+    fprintf(2, "time: fork failed\n");
+    exit(1);
+  }
+  if(pid == 0){
+    exec(argv[1], argv + 1);
+    fprintf(2, "time: exec %s failed\n", argv[1]);
+    exit(1);
+  }
+  wait(&xst);
+  t1 = usec();
+  if(getrusage(RUSAGE_CHILDREN, &ru) < 0){
+    fprintf(2, "time: getrusage failed\n");
+    exit(1);
+  }
+  printf("real %dms user %dms sys %dms\n", (int)((t1 - t0) / 1000),
+         (int)(ru.ru_utime / 1000), (int)(ru.ru_stime / 1000));
+  printf("faults %d minor %d major %d cow\n", (int)ru.ru_minflt,
+         (int)ru.ru_majflt, (int)ru.ru_cowflt);
+  printf("blocks %d in %d out\n", (int)ru.ru_inblock, (int)ru.ru_oublock);
+  printf("switches %d voluntary %d involuntary\n", (int)ru.ru_nvcsw,
+         (int)ru.ru_nivcsw);
+  exit(xst);
+}
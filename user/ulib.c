@@ -145,3 +145,76 @@ memcpy(void *dst, const void *src, uint n)
 {
   return memmove(dst, src, n);
 }
+
+//
+// Mutexes and condition variables for threads, which only
+// enter the kernel when they have to wait or wake a waiter.
+// A mutex's state is 0 if it's unlocked, 1 if it's locked,
+// and 2 if it's locked and someone may be waiting for it.
+//
+
+void
+mutex_init(struct mutex *m)
+{
+  m->state = 0;
+}
+
+void
+mutex_lock(struct mutex *m)
+{
+  int c;
+
+  if((c = __sync_val_compare_and_swap(&m->state, 0, 1)) == 0)
+    return;
+  // mark the mutex contended, then wait until it's released.
+  if(c != 2)
+    c = __sync_lock_test_and_set(&m->state, 2);
+  while(c != 0){
+    futexwait(&m->state, 2);
+    c = __sync_lock_test_and_set(&m->state, 2);
+  }
+}
+
+void
+mutex_unlock(struct mutex *m)
+{
+  if(__sync_fetch_and_sub(&m->state, 1) != 1){
+    __atomic_store_n(&m->state, 0, __ATOMIC_RELEASE);
+    futexwake(&m->state, 1);
+  }
+}
+
+void
+cond_init(struct cond *c)
+{
+  c->seq = 0;
+}
+
+// Release m, wait for a cond_signal() or cond_broadcast(),
+// and lock m again.  May return early, so callers must
+// check what they were waiting for.
+void
+cond_wait(struct cond *c, struct mutex *m)
+{
+  int seq = __atomic_load_n(&c->seq, __ATOMIC_RELAXED);
+
+  mutex_unlock(m);
+  futexwait(&c->seq, seq);
+  // others may be waiting, so lock m as contended.
+  while(__sync_lock_test_and_set(&m->state, 2) != 0)
+    futexwait(&m->state, 2);
+}
+
+void
+cond_signal(struct cond *c)
+{
+  __sync_fetch_and_add(&c->seq, 1);
+  futexwake(&c->seq, 1);
+}
+
+void
+cond_broadcast(struct cond *c)
+{
+  __sync_fetch_and_add(&c->seq, 1);
+  futexwake(&c->seq, 0x7fffffff);  // all of them
+}
@@ -2,89 +2,237 @@
 #include "kernel/stat.h"
 #include "user/user.h"
 #include "kernel/param.h"
+#include "kernel/riscv.h"
 
-// Memory allocator by Kernighan and Ritchie,
-// The C programming Language, 2nd ed.  Section 8.7.
+// Memory allocator.
+//
+// A small request is rounded up to one of NCLASS size classes,
+// each with its own list of free blocks, so that malloc() and
+// free() of a small block just pop or push that list.  A class
+// with no free blocks carves up a fresh page.  A larger request
+// gets a run of whole pages to itself.  Free runs are kept in
+// address order and merged with their neighbours, and the heap
+// grows with sbrk() by at least BATCH pages at a time.  A free
+// run of TRIM or more pages at the top of the heap is given back
+// with a negative sbrk(), so that a process's memory shrinks
+// after a spike; the pages of a size class stay with it.
+//
+// One futex mutex guards it all, so that threads (see thread.c)
+// can share it; uncontended, it costs an atomic swap or two.
+
+#define BATCH  16      // least number of pages sbrk() asks for
+#define TRIM   (2*BATCH)  // least number of free pages to give back
+#define MAXSMALL 2048  // largest block, header included, from a class
 
 typedef long Align;
 
+// Every block starts with a header giving its size,
+// which free() uses to decide where the block goes.
 union header {
   struct {
-    union header *ptr;
-    uint size;
+    union header *next;  // next free block of its class
+    uint64 size;         // bytes, header included
   } s;
   Align x;
 };
 
 typedef union header Header;
 
-static Header base;
-static Header *freep;
+// A run of free pages.
+struct run {
+  struct run *next;      // next run, at a higher address
+  uint64 npages;
+};
 
-void
-free(void *ap)
+// chosen so that a page splits into blocks with little left over.
+static ushort classsize[] = {
+  32, 48, 64, 80, 96, 128, 160, 192, 256, 320, 384, 512, 640, 816,
+  1024, 1360, MAXSMALL,
+};
+#define NCLASS (sizeof(classsize) / sizeof(classsize[0]))
+
+static uchar classof[MAXSMALL/16 + 1];  // by size, in 16-byte units
+static Header *freelist[NCLASS];
+static struct run *runs;
+static struct mutex lock;  // protects all of the above
+
+// Put the n pages at p on the list of free runs.
+static void
+putpages(void *p, uint64 n)
 {
-  Header *bp, *p;
-
-  bp = (Header*)ap - 1;
-  for(p = freep; !(bp > p && bp < p->s.ptr); p = p->s.ptr)
-    if(p >= p->s.ptr && (bp > p || bp < p->s.ptr))
-      break;
-  if(bp + bp->s.size == p->s.ptr){
-    bp->s.size += p->s.ptr->s.size;
-    bp->s.ptr = p->s.ptr->s.ptr;
-  } else
-    bp->s.ptr = p->s.ptr;
-  if(p + p->s.size == bp){
-    p->s.size += bp->s.size;
-    p->s.ptr = bp->s.ptr;
-  } else
-    p->s.ptr = bp;
-  freep = p;
+  struct run *r = p, *prev = 0, *next;
+
+  for(next = runs; next && next < r; next = next->next)
+    prev = next;
+  r->npages = n;
+  r->next = next;
+  if(next && (char*)r + n*PGSIZE == (char*)next){
+    r->npages += next->npages;
+    r->next = next->next;
+  }
+  if(prev && (char*)prev + prev->npages*PGSIZE == (char*)r){
+    prev->npages += r->npages;
+    prev->next = r->next;
+  } else if(prev)
+    prev->next = r;
+  else
+    runs = r;
 }
 
-static Header*
-morecore(uint nu)
+// Give the free run at the top of the heap back to the kernel,
+// if it's big enough not to be wanted again right away.
+static void
+trim(void)
 {
-  char *p;
-  Header *hp;
+  struct run *r, **rp;
+  uint64 n;
 
-  if(nu < 4096)
-    nu = 4096;
-  p = sbrk(nu * sizeof(Header));
-  if(p == (char*)-1)
-    return 0;
-  hp = (Header*)p;
-  hp->s.size = nu;
-  free((void*)(hp + 1));
-  return freep;
+  if(runs == 0)
+    return;
+  for(rp = &runs; (*rp)->next; rp = &(*rp)->next)
+    ;
+  r = *rp;
+  if(r->npages < TRIM || (char*)r + r->npages*PGSIZE != sbrk(0))
+    return;
+  // sbrk() takes an int.
+  n = r->npages;
+  if(n > 0x7fffffff / PGSIZE)
+    n = 0x7fffffff / PGSIZE;
+  if(n == r->npages)
+    *rp = 0;
+  else
+    r->npages -= n;
+  sbrk(-(int)(n*PGSIZE));
 }
 
-void*
-malloc(uint nbytes)
+// Return n contiguous free pages, from the lowest run with
+// room for them, growing the heap if there's none.
+static void*
+getpages(uint64 n)
 {
-  Header *p, *prevp;
-  uint nunits;
+  struct run *r, **rp, *rest;
+  char *p;
+  uint64 grow, pad;
 
-  nunits = (nbytes + sizeof(Header) - 1)/sizeof(Header) + 1;
-  if((prevp = freep) == 0){
-    base.s.ptr = freep = prevp = &base;
-    base.s.size = 0;
-  }
-  for(p = prevp->s.ptr; ; prevp = p, p = p->s.ptr){
-    if(p->s.size >= nunits){
-      if(p->s.size == nunits)
-        prevp->s.ptr = p->s.ptr;
-      else {
-        p->s.size -= nunits;
-        p += p->s.size;
-        p->s.size = nunits;
+  for(;;){
+    for(rp = &runs; (r = *rp) != 0; rp = &r->next){
+      if(r->npages == n){
+        *rp = r->next;
+        return r;
+      }
+      if(r->npages > n){
+        rest = (struct run*)((char*)r + n*PGSIZE);
+        rest->npages = r->npages - n;
+        rest->next = r->next;
+        *rp = rest;
+        return r;
       }
-      freep = prevp;
-      return (void*)(p + 1);
     }
-    if(p == freep)
-      if((p = morecore(nunits)) == 0)
+
+    // the break may not be page-aligned, if the program
+    // has called sbrk() itself.
+    if(n >= 0x7fffffff / PGSIZE)
+      return 0;
+    grow = n > BATCH ? n : BATCH;
+    p = sbrk(0);
+    pad = PGROUNDUP((uint64)p) - (uint64)p;
+    if(sbrk(pad + grow*PGSIZE) == (char*)-1){
+      // memory is short; settle for what's needed.
+      grow = n;
+      if(sbrk(pad + grow*PGSIZE) == (char*)-1)
         return 0;
+    }
+    putpages(p + pad, grow);
+  }
+}
+
+// Fill class c's free list with the blocks of a fresh page.
+static int
+refill(int c)
+{
+  uint size = classsize[c];
+  char *page;
+  Header *h;
+  int i;
+
+  if((page = getpages(1)) == 0)
+    return -1;
+  for(i = PGSIZE / size - 1; i >= 0; i--){
+    h = (Header*)(page + i*size);
+    h->s.size = size;
+    h->s.next = freelist[c];
+    freelist[c] = h;
+  }
+  return 0;
+}
+
+static void
+dofree(void *ap)
+{
+  Header *h;
+  int c;
+
+  h = (Header*)ap - 1;
+  if(h->s.size > MAXSMALL){
+    putpages(h, h->s.size / PGSIZE);
+    trim();
+    return;
+  }
+  c = classof[h->s.size / 16];
+  h->s.next = freelist[c];
+  freelist[c] = h;
+}
+
+static void*
+domalloc(uint nbytes)
+{
+  static int ready;
+  Header *h;
+  uint64 n;
+  int c, i;
+
+  if(!ready){
+    for(i = 0, c = 0; i <= MAXSMALL/16; i++){
+      while(classsize[c] < i*16)
+        c++;
+      classof[i] = c;
+    }
+    ready = 1;
+  }
+
+  n = ((uint64)nbytes + sizeof(Header) + 15) & ~15L;
+  if(n > MAXSMALL){
+    n = PGROUNDUP(n);
+    if((h = getpages(n / PGSIZE)) == 0)
+      return 0;
+    h->s.size = n;
+    return (void*)(h + 1);
   }
+  c = classof[n / 16];
+  if(freelist[c] == 0 && refill(c) < 0)
+    return 0;
+  h = freelist[c];
+  freelist[c] = h->s.next;
+  return (void*)(h + 1);
+}
+
+void
+free(void *ap)
+{
+  if(ap == 0)
+    return;
+  mutex_lock(&lock);
+  dofree(ap);
+  mutex_unlock(&lock);
+}
+
+void*
+malloc(uint nbytes)
+{
+  void *p;
+
+  mutex_lock(&lock);
+  p = domalloc(nbytes);
+  mutex_unlock(&lock);
+  return p;
 }
@@ -1,4 +1,15 @@
 struct stat;
+struct iovec;
+struct timespec;
+struct rusage;
+
+struct mutex {
+  int state;
+};
+
+struct cond {
+  int seq;
+};
 
 // system calls
 int fork(void);
@@ -22,6 +33,20 @@ int getpid(void);
 char* sbrk(int);
 int sleep(int);
 int uptime(void);
+void* mmap(void*, uint64, int, int, int, uint);
+int munmap(void*, uint64);
+int readv(int, const struct iovec*, int);
+int writev(int, const struct iovec*, int);
+int pread(int, void*, int, int);
+int pwrite(int, const void*, int, int);
+int nice(int);
+int clock_gettime(int, struct timespec*);
+int nanosleep(const struct timespec*, struct timespec*);
+int clone(void (*)(void*), void*, void*);
+int join(int, int*);
+int futexwait(int*, int);
+int futexwake(int*, int);
+int getrusage(int, struct rusage*);
 
 // ulib.c
 int stat(const char*, struct stat*);
@@ -37,7 +62,21 @@ void* memset(void*, int, uint);
 int atoi(const char*);
 int memcmp(const void *, const void *, uint);
 void *memcpy(void *, const void *, uint);
+void mutex_init(struct mutex*);
+void mutex_lock(struct mutex*);
+void mutex_unlock(struct mutex*);
+void cond_init(struct cond*);
+void cond_wait(struct cond*, struct mutex*);
+void cond_signal(struct cond*);
+void cond_broadcast(struct cond*);
 
 // umalloc.c
 void* malloc(uint);
 void free(void*);
+
+// statistics.c
+int statistics(void*, int);
+
+// thread.c
+int thread_create(void (*)(void*), void*);
+int thread_join(int, int*);
@@ -7,6 +7,9 @@
 #include "kernel/syscall.h"
 #include "kernel/memlayout.h"
 #include "kernel/riscv.h"
+#include "kernel/uio.h"
+#include "kernel/time.h"
+#include "kernel/rusage.h"
 
 //
 // Tests xv6 system calls.  usertests without arguments runs them all
@@ -733,6 +736,151 @@ exectest(char *s)
 
 }
 
+// nice() clamps the nice value, and fork() inherits it.
+void
+nicetest(char *s)
+{
+  int pid, xstatus;
+
+  if(nice(0) != 0 || nice(5) != 5 || nice(-3) != 2){
+    printf("%s: nice() returned wrong value\n", s);
+    exit(1);
+  }
+  if(nice(100) != NICEMAX || nice(-1000000000) != NICEMIN){
+    printf("%s: nice() didn't clamp\n", s);
+    exit(1);
+  }
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0)
+    exit(nice(0) == NICEMIN ? 0 : 1);
+  wait(&xstatus);
+  if(xstatus != 0){
+    printf("%s: child didn't inherit nice value\n", s);
+    exit(1);
+  }
+}
+
+// nanosleep() sleeps at least as long as asked, by clock_gettime().
+void
+nanosleeptest(char *s)
+{
+  struct timespec t0, t1, req;
+  uint64 ns;
+
+  req.tv_sec = 0;
+  req.tv_nsec = 20*1000*1000;
+  if(clock_gettime(CLOCK_MONOTONIC, &t0) < 0 || nanosleep(&req, 0) < 0 ||
+     clock_gettime(CLOCK_MONOTONIC, &t1) < 0){
+    printf("%s: nanosleep or clock_gettime failed\n", s);
+    exit(1);
+  }
+  ns = (t1.tv_sec - t0.tv_sec) * NSEC + t1.tv_nsec - t0.tv_nsec;
+  if(t1.tv_nsec >= NSEC || ns < req.tv_nsec){
+    printf("%s: slept %d ns, not %d\n", s, (int)ns, (int)req.tv_nsec);
+    exit(1);
+  }
+  req.tv_nsec = NSEC;
+  if(nanosleep(&req, 0) != -1){
+    printf("%s: nanosleep accepted bad tv_nsec\n", s);
+    exit(1);
+  }
+  if(clock_gettime(CLOCK_MONOTONIC+1, &t0) != -1){
+    printf("%s: clock_gettime accepted bad clock\n", s);
+    exit(1);
+  }
+}
+
+// getrusage() counts a process's CPU time, faults, file
+// blocks, and context switches, and those of its children.
+void
+rusagetest(char *s)
+{
+  struct rusage r0, r1, rc;
+  char buf[BSIZE];
+  int fd, pid, xst;
+  uint64 t;
+
+  if(getrusage(RUSAGE_SELF, &r0) < 0 || getrusage(RUSAGE_CHILDREN+2, &r1) != -1){
+    printf("%s: getrusage arguments mishandled\n", s);
+    exit(1);
+  }
+  // spin for a bit, then sleep.
+  for(t = uptime(); uptime() < t + 2; )
+    ;
+  sleep(1);
+  fd = open("rusagefile", O_CREATE|O_RDWR);
+  if(fd < 0 || write(fd, buf, sizeof(buf)) != sizeof(buf)){
+    printf("%s: create rusagefile failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  // the block just written is still cached, so reading it
+  // back isn't a disk read.
+  fd = open("rusagefile", O_RDONLY);
+  getrusage(RUSAGE_SELF, &rc);
+  if(fd < 0 || read(fd, buf, sizeof(buf)) != sizeof(buf)){
+    printf("%s: read rusagefile failed\n", s);
+    exit(1);
+  }
+  getrusage(RUSAGE_SELF, &r1);
+  if(r1.ru_inblock != rc.ru_inblock){
+    printf("%s: cached read counted as a block in\n", s);
+    exit(1);
+  }
+  close(fd);
+  unlink("rusagefile");
+  getrusage(RUSAGE_SELF, &r1);
+  if(r1.ru_utime + r1.ru_stime <= r0.ru_utime + r0.ru_stime ||
+     r1.ru_nvcsw <= r0.ru_nvcsw || r1.ru_oublock <= r0.ru_oublock){
+    printf("%s: own usage didn't grow\n", s);
+    exit(1);
+  }
+
+  // a child that writes to a copy-on-write page.
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    *(volatile char*)buf = 1;
+    exit(0);
+  }
+  if(wait(&xst) != pid || xst != 0){
+    printf("%s: child failed\n", s);
+    exit(1);
+  }
+  getrusage(RUSAGE_CHILDREN, &rc);
+  if(rc.ru_cowflt == 0){
+    printf("%s: child's copy-on-write fault not counted\n", s);
+    exit(1);
+  }
+}
+
+// the statistics device reports per-CPU and per-lock counters.
+void
+statstest(char *s)
+{
+  static char buf[4096];
+  char *want[] = { "cpu 0:", "kmem: free ", "lock kmem ", "lock proc (", "slab file:", 0 };
+  int i, j, n;
+
+  n = statistics(buf, sizeof(buf));
+  for(i = 0; want[i]; i++){
+    for(j = 0; j + strlen(want[i]) <= n; j++)
+      if(memcmp(buf + j, want[i], strlen(want[i])) == 0)
+        break;
+    if(j + strlen(want[i]) > n){
+      printf("%s: no \"%s\" in statistics\n", s, want[i]);
+      exit(1);
+    }
+  }
+}
+
 // simple fork and pipe read/write
 
 void
@@ -788,6 +936,93 @@ pipe1(char *s)
   }
 }
 
+// page-aligned whole pages written to a pipe are passed by
+// reference, so the writer changing them afterwards must not
+// change what the reader sees.
+void
+pipepages(char *s)
+{
+  int fds[2], pid, i, n, xstatus;
+  char *p, *q, *buf;
+  enum { NPG = 4 };
+
+  p = sbrk(0);
+  buf = sbrk(PGROUNDUP((uint64)p) - (uint64)p + (NPG+1)*PGSIZE);
+  if(buf == (char*)0xffffffffffffffffL){
+    printf("%s: sbrk failed\n", s);
+    exit(1);
+  }
+  buf = (char*)PGROUNDUP((uint64)buf);
+
+  if(pipe(fds) != 0){
+    printf("%s: pipe() failed\n", s);
+    exit(1);
+  }
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork() failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    close(fds[0]);
+    for(i = 0; i < NPG*PGSIZE; i++)
+      buf[i] = i / PGSIZE + 'a';
+    if(write(fds[1], buf, NPG*PGSIZE) != NPG*PGSIZE){
+      printf("%s: pipe write failed\n", s);
+      exit(1);
+    }
+    memset(buf, 'x', NPG*PGSIZE);
+    if(write(fds[1], buf + 1, 10) != 10){
+      printf("%s: pipe write failed\n", s);
+      exit(1);
+    }
+    exit(0);
+  }
+  close(fds[1]);
+
+  // one page into an aligned buffer, then the rest unaligned.
+  memset(buf, 0, (NPG+1)*PGSIZE);
+  if(read(fds[0], buf, PGSIZE) != PGSIZE){
+    printf("%s: pipe read failed\n", s);
+    exit(1);
+  }
+  q = buf + PGSIZE + 100;
+  for(n = 0; n < (NPG-1)*PGSIZE + 10; n += i){
+    if((i = read(fds[0], q + n, (NPG-1)*PGSIZE + 10 - n)) <= 0){
+      printf("%s: pipe read failed\n", s);
+      exit(1);
+    }
+  }
+  for(i = 0; i < PGSIZE; i++){
+    if(buf[i] != 'a'){
+      printf("%s: wrong data in first page\n", s);
+      exit(1);
+    }
+  }
+  for(i = 0; i < (NPG-1)*PGSIZE; i++){
+    if(q[i] != i / PGSIZE + 'b'){
+      printf("%s: wrong data at %d\n", s, i);
+      exit(1);
+    }
+  }
+  for(; i < n; i++){
+    if(q[i] != 'x'){
+      printf("%s: wrong trailing data\n", s);
+      exit(1);
+    }
+  }
+  // the reader owns its copy of the mapped page.
+  buf[0] = 'z';
+  if(read(fds[0], q, 1) != 0){
+    printf("%s: pipe not empty\n", s);
+    exit(1);
+  }
+  close(fds[0]);
+  wait(&xstatus);
+  if(xstatus != 0)
+    exit(xstatus);
+}
+
 
 // test if child is killed (status = -1)
 void
@@ -818,6 +1053,269 @@ killstatus(char *s)
   exit(0);
 }
 
+// more processes than the old fixed-size process table held
+// can run at once, and kill() finds each of them by pid.
+void
+manyprocs(char *s)
+{
+  enum { N = 200 };
+  int pids[N], fds[2], i, xst;
+  char c;
+
+  if(pipe(fds) != 0){
+    printf("%s: pipe() failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < N; i++){
+    pids[i] = fork();
+    if(pids[i] < 0){
+      printf("%s: fork %d failed\n", s, i);
+      for(i--; i >= 0; i--)
+        kill(pids[i]);
+      exit(1);
+    }
+    if(pids[i] == 0){
+      close(fds[1]);
+      read(fds[0], &c, 1);   // blocks until killed
+      exit(0);
+    }
+  }
+  close(fds[0]);
+
+  for(i = N-1; i >= 0; i--){
+    if(kill(pids[i]) != 0){
+      printf("%s: kill(%d) failed\n", s, pids[i]);
+      exit(1);
+    }
+  }
+  for(i = 0; i < N; i++){
+    if(wait(&xst) < 0 || xst != -1){
+      printf("%s: child not killed\n", s);
+      exit(1);
+    }
+  }
+  if(kill(pids[0]) != -1){
+    printf("%s: kill() of a reaped pid succeeded\n", s);
+    exit(1);
+  }
+  close(fds[1]);
+}
+
+// more files can be open at once than the old fixed-size
+// file table held.
+void
+manyfiles(char *s)
+{
+  enum { NCHILD = 15, NPIPE = 5 };
+  int ready[2], hold[2], fds[2], i, j;
+  char c;
+
+  if(pipe(ready) < 0 || pipe(hold) < 0){
+    printf("%s: pipe() failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < NCHILD; i++){
+    int pid = fork();
+    if(pid < 0){
+      printf("%s: fork failed\n", s);
+      exit(1);
+    }
+    if(pid == 0){
+      close(ready[0]);
+      close(hold[1]);
+      c = 'y';
+      for(j = 0; j < NPIPE; j++)
+        if(pipe(fds) < 0)
+          c = 'n';
+      write(ready[1], &c, 1);
+      read(hold[0], &c, 1);   // until the parent closes hold[1]
+      exit(0);
+    }
+  }
+  close(ready[1]);
+  close(hold[0]);
+  for(i = 0; i < NCHILD; i++){
+    if(read(ready[0], &c, 1) != 1 || c != 'y'){
+      printf("%s: couldn't open %d pipes\n", s, NCHILD*NPIPE);
+      exit(1);
+    }
+  }
+  close(hold[1]);
+  for(i = 0; i < NCHILD; i++)
+    wait(0);
+  close(ready[0]);
+}
+
+static int threadcount;
+
+static void
+threadadd(void *arg)
+{
+  int i;
+
+  for(i = 0; i < 1000; i++)
+    __sync_fetch_and_add(&threadcount, 1);
+  exit((uint64)arg);
+}
+
+// allocate and free from several threads at once, checking
+// that no two threads are ever handed the same block.
+static void
+threadmallocer(void *arg)
+{
+  char *p[8];
+  int i, j, n;
+
+  for(i = 0; i < 200; i++){
+    for(j = 0; j < 8; j++){
+      n = 16 + 40*j;
+      if((p[j] = malloc(n)) == 0)
+        exit(-1);
+      memset(p[j], (uint64)arg, n);
+    }
+    for(j = 0; j < 8; j++){
+      n = 16 + 40*j;
+      if(p[j][0] != (uint64)arg || p[j][n-1] != (uint64)arg)
+        exit(-1);
+      free(p[j]);
+    }
+  }
+  exit((uint64)arg);
+}
+
+static void
+threadspin(void *arg)
+{
+  for(;;)
+    ;
+}
+
+// threads share memory and are reaped by join(); a process
+// that exits with threads still running takes them with it.
+void
+threads(char *s)
+{
+  enum { N = 4 };
+  int tids[N], i, xst, pid;
+
+  threadcount = 0;
+  for(i = 0; i < N; i++){
+    tids[i] = thread_create(threadadd, (void*)(uint64)i);
+    if(tids[i] < 0){
+      printf("%s: thread_create failed\n", s);
+      exit(1);
+    }
+  }
+  for(i = 0; i < N; i++){
+    if(thread_join(tids[i], &xst) != tids[i] || xst != i){
+      printf("%s: thread_join(%d) failed\n", s, tids[i]);
+      exit(1);
+    }
+  }
+  if(threadcount != N*1000){
+    printf("%s: count %d, expected %d\n", s, threadcount, N*1000);
+    exit(1);
+  }
+  for(i = 0; i < N; i++){
+    tids[i] = thread_create(threadmallocer, (void*)(uint64)(i+1));
+    if(tids[i] < 0){
+      printf("%s: thread_create failed\n", s);
+      exit(1);
+    }
+  }
+  for(i = 0; i < N; i++){
+    if(thread_join(tids[i], &xst) != tids[i] || xst != i+1){
+      printf("%s: concurrent malloc failed\n", s);
+      exit(1);
+    }
+  }
+  if(join(tids[0], 0) != -1){
+    printf("%s: second join succeeded\n", s);
+    exit(1);
+  }
+  if(wait(0) != -1){
+    printf("%s: wait() returned a thread\n", s);
+    exit(1);
+  }
+
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    if(thread_create(threadspin, 0) < 0)
+      exit(1);
+    exit(0);
+  }
+  if(wait(&xst) != pid || xst != 0){
+    printf("%s: threaded child not reaped\n", s);
+    exit(1);
+  }
+}
+
+static struct mutex futexmu;
+static struct cond futexcv;
+static int futexcount, futexdone;
+
+static void
+futexadd(void *arg)
+{
+  int i;
+
+  for(i = 0; i < 1000; i++){
+    mutex_lock(&futexmu);
+    futexcount++;
+    mutex_unlock(&futexmu);
+  }
+  mutex_lock(&futexmu);
+  futexdone++;
+  cond_signal(&futexcv);
+  mutex_unlock(&futexmu);
+}
+
+// threads serialize through a futex-based mutex, and
+// wait for each other with a condition variable.
+void
+futextest(char *s)
+{
+  enum { N = 4 };
+  int tids[N], i, word = 1;
+
+  if(futexwait(&word, 2) != -1){
+    printf("%s: futexwait on a changed word slept\n", s);
+    exit(1);
+  }
+  if(futexwait((int*)0xffffffffff000L, 0) != -1 || futexwake((int*)1, 1) != -1){
+    printf("%s: bad futex address accepted\n", s);
+    exit(1);
+  }
+  if(futexwake(&word, 1) != 0){
+    printf("%s: futexwake woke someone\n", s);
+    exit(1);
+  }
+
+  mutex_init(&futexmu);
+  cond_init(&futexcv);
+  futexcount = futexdone = 0;
+  for(i = 0; i < N; i++){
+    if((tids[i] = thread_create(futexadd, 0)) < 0){
+      printf("%s: thread_create failed\n", s);
+      exit(1);
+    }
+  }
+  mutex_lock(&futexmu);
+  while(futexdone < N)
+    cond_wait(&futexcv, &futexmu);
+  mutex_unlock(&futexmu);
+  for(i = 0; i < N; i++)
+    thread_join(tids[i], 0);
+  if(futexcount != N*1000){
+    printf("%s: count %d, expected %d\n", s, futexcount, N*1000);
+    exit(1);
+  }
+}
+
 // meant to be run w/ at most two CPUs
 void
 preempt(char *s)
@@ -1089,6 +1587,68 @@ mem(char *s)
   }
 }
 
+// blocks of every size class, and large ones, don't overlap,
+// and a freed block is reused for the next request of its size.
+void
+mallocsizes(char *s)
+{
+  enum { N = 64 };
+  char *p[N], *q;
+  uint sz;
+  int i, j;
+
+  for(i = 0; i < N; i++){
+    sz = 1 + i*i*5;   // 1 to 19846 bytes
+    if((p[i] = malloc(sz)) == 0 || (uint64)p[i] % 16 != 0){
+      printf("%s: malloc(%d) failed\n", s, sz);
+      exit(1);
+    }
+    memset(p[i], i, sz);
+  }
+  for(i = 0; i < N; i++){
+    sz = 1 + i*i*5;
+    for(j = 0; j < sz; j++){
+      if(p[i][j] != (char)i){
+        printf("%s: block %d overwritten\n", s, i);
+        exit(1);
+      }
+    }
+  }
+  q = p[10];
+  free(q);
+  if((p[10] = malloc(1 + 10*10*5)) != q){
+    printf("%s: freed block not reused\n", s);
+    exit(1);
+  }
+  for(i = 0; i < N; i++)
+    free(p[i]);
+  free(0);
+}
+
+// free() gives a big block at the top of the heap back
+// to the kernel.
+void
+malloctrim(char *s)
+{
+  char *top, *p;
+
+  top = sbrk(0);
+  if((p = malloc(1024*1024)) == 0){
+    printf("%s: malloc failed\n", s);
+    exit(1);
+  }
+  if(sbrk(0) < top + 1024*1024){
+    printf("%s: heap didn't grow\n", s);
+    exit(1);
+  }
+  memset(p, 1, 1024*1024);
+  free(p);
+  if(sbrk(0) > (char*)PGROUNDUP((uint64)top)){
+    printf("%s: heap didn't shrink\n", s);
+    exit(1);
+  }
+}
+
 // More file system tests
 
 // two processes write to the same file descriptor
@@ -1727,6 +2287,158 @@ bigwrite(char *s)
   }
 }
 
+// a single write() of a whole maximum-size file.
+void
+hugewrite(char *s)
+{
+  int fd, i, sz = MAXFILE*BSIZE;
+  char *p;
+
+  p = sbrk(sz);
+  if(p == (char*)0xffffffffffffffffL){
+    printf("%s: sbrk failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < sz; i++)
+    p[i] = i / BSIZE;
+
+  unlink("hugewrite");
+  fd = open("hugewrite", O_CREATE | O_RDWR);
+  if(fd < 0){
+    printf("%s: cannot create hugewrite\n", s);
+    exit(1);
+  }
+  if(write(fd, p, sz) != sz){
+    printf("%s: write(%d) failed\n", s, sz);
+    exit(1);
+  }
+  close(fd);
+
+  memset(p, 0xff, sz);
+  fd = open("hugewrite", O_RDONLY);
+  if(read(fd, p, sz) != sz){
+    printf("%s: read failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  for(i = 0; i < sz; i++){
+    if(p[i] != (char)(i / BSIZE)){
+      printf("%s: wrong data at %d\n", s, i);
+      exit(1);
+    }
+  }
+  unlink("hugewrite");
+  sbrk(-sz);
+}
+
+// readv(), writev(), pread(), and pwrite().
+void
+vectorio(char *s)
+{
+  char a[10], b[300], c[5], buf[400];
+  struct iovec iov[3];
+  int fd, i, n, fds[2];
+
+  memset(a, 'a', sizeof(a));
+  memset(b, 'b', sizeof(b));
+  memset(c, 'c', sizeof(c));
+  iov[0].iov_base = a;
+  iov[0].iov_len = sizeof(a);
+  iov[1].iov_base = b;
+  iov[1].iov_len = sizeof(b);
+  iov[2].iov_base = c;
+  iov[2].iov_len = sizeof(c);
+
+  unlink("vectorio");
+  fd = open("vectorio", O_CREATE | O_RDWR);
+  if(fd < 0){
+    printf("%s: cannot create vectorio\n", s);
+    exit(1);
+  }
+  if(writev(fd, iov, 3) != 315){
+    printf("%s: writev failed\n", s);
+    exit(1);
+  }
+  // pwrite() and pread() mustn't move the file offset.
+  if(pwrite(fd, "xy", 2, 9) != 2){
+    printf("%s: pwrite failed\n", s);
+    exit(1);
+  }
+  if(pread(fd, buf, 4, 8) != 4 || buf[0] != 'a' || buf[1] != 'x' ||
+     buf[2] != 'y' || buf[3] != 'b'){
+    printf("%s: pread got wrong data\n", s);
+    exit(1);
+  }
+  if(write(fd, "z", 1) != 1){
+    printf("%s: write failed\n", s);
+    exit(1);
+  }
+  if(pread(fd, buf, sizeof(buf), 0) != 316){
+    printf("%s: pread wrong length\n", s);
+    exit(1);
+  }
+  if(buf[314] != 'c' || buf[315] != 'z'){
+    printf("%s: pwrite moved the offset\n", s);
+    exit(1);
+  }
+  if(pread(fd, buf, 1, 400) != 0){
+    printf("%s: pread past EOF\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  // readv() fills each buffer in turn, and stops short at EOF.
+  memset(a, 0, sizeof(a));
+  memset(b, 0, sizeof(b));
+  memset(c, 0, sizeof(c));
+  iov[2].iov_len = 3;
+  fd = open("vectorio", O_RDONLY);
+  if(readv(fd, iov, 3) != 313){
+    printf("%s: readv failed\n", s);
+    exit(1);
+  }
+  if(a[8] != 'a' || a[9] != 'x' || b[0] != 'y' || b[1] != 'b' ||
+     c[0] != 'c' || c[2] != 'c'){
+    printf("%s: readv got wrong data\n", s);
+    exit(1);
+  }
+  iov[0].iov_len = 1;
+  iov[1].iov_len = 5;
+  if(readv(fd, iov, 2) != 3 || a[0] != 'c' || b[0] != 'c' || b[1] != 'z'){
+    printf("%s: readv at EOF failed\n", s);
+    exit(1);
+  }
+  if(readv(fd, iov, MAXIOV+1) != -1){
+    printf("%s: readv allowed too many iovecs\n", s);
+    exit(1);
+  }
+  close(fd);
+  unlink("vectorio");
+
+  // positional I/O makes no sense on a pipe.
+  if(pipe(fds) < 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  if(pwrite(fds[1], "x", 1, 0) != -1 || pread(fds[0], buf, 1, 0) != -1){
+    printf("%s: positional I/O on a pipe\n", s);
+    exit(1);
+  }
+  iov[0].iov_len = sizeof(a);
+  iov[1].iov_len = sizeof(b);
+  if(writev(fds[1], iov, 2) != 310){
+    printf("%s: writev to pipe failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < 310; i += n){
+    if((n = read(fds[0], buf, sizeof(buf))) <= 0){
+      printf("%s: read from pipe failed\n", s);
+      exit(1);
+    }
+  }
+  close(fds[0]);
+  close(fds[1]);
+}
 
 void
 bigfile(char *s)
@@ -2586,6 +3298,233 @@ badarg(char *s)
   exit(0);
 }
 
+// page-aligned reads of a cached file page share the page
+// copy-on-write; check that neither the file nor the reader
+// sees the other's later writes.
+void
+pagecache(char *s)
+{
+  char *a, *b;
+  int fd, i;
+
+  unlink("pagecache");
+  fd = open("pagecache", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf("%s: create failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < 2; i++){
+    memset(buf, 'a' + i, PGSIZE);
+    if(write(fd, buf, PGSIZE) != PGSIZE){
+      printf("%s: write failed\n", s);
+      exit(1);
+    }
+  }
+  close(fd);
+
+  a = sbrk(0);
+  a = sbrk(PGROUNDUP((uint64)a) - (uint64)a + 2*PGSIZE);
+  a = (char*)PGROUNDUP((uint64)a);
+  b = a + PGSIZE;
+
+  fd = open("pagecache", O_RDWR);
+  if(read(fd, a, PGSIZE) != PGSIZE || a[0] != 'a' || a[PGSIZE-1] != 'a'){
+    printf("%s: first read wrong\n", s);
+    exit(1);
+  }
+
+  // the reader's copy is private.
+  a[0] = 'x';
+
+  // and so is the file's.
+  close(fd);
+  fd = open("pagecache", O_RDWR);
+  memset(buf, 'y', PGSIZE);
+  if(write(fd, buf, 1) != 1){
+    printf("%s: overwrite failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  if(a[0] != 'x' || a[1] != 'a'){
+    printf("%s: reader's page changed\n", s);
+    exit(1);
+  }
+
+  fd = open("pagecache", O_RDONLY);
+  if(read(fd, b, PGSIZE) != PGSIZE || b[0] != 'y' || b[1] != 'a'){
+    printf("%s: second read wrong\n", s);
+    exit(1);
+  }
+  if(read(fd, a, PGSIZE) != PGSIZE || a[0] != 'b' || b[0] != 'y'){
+    printf("%s: third read wrong\n", s);
+    exit(1);
+  }
+  close(fd);
+  unlink("pagecache");
+}
+
+// mmap() a file privately and shared, and check that the
+// mappings and the file see each other's writes as they should.
+void
+mmaptest(char *s)
+{
+  char *p, *q;
+  int fd, pid, xstatus;
+
+  unlink("mmap");
+  fd = open("mmap", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf("%s: create failed\n", s);
+    exit(1);
+  }
+  memset(buf, 'a', PGSIZE);
+  write(fd, buf, PGSIZE);
+  memset(buf, 'b', PGSIZE);
+  write(fd, buf, PGSIZE);
+  memset(buf, 'c', 100);
+  if(write(fd, buf, 100) != 100){
+    printf("%s: write failed\n", s);
+    exit(1);
+  }
+
+  p = mmap(0, 2*PGSIZE+100, PROT_READ|PROT_WRITE, MAP_PRIVATE, fd, 0);
+  if(p == (char*)0xffffffffffffffffL){
+    printf("%s: mmap private failed\n", s);
+    exit(1);
+  }
+  if(p[0] != 'a' || p[PGSIZE] != 'b' || p[2*PGSIZE+99] != 'c' || p[2*PGSIZE+100] != 0){
+    printf("%s: private mapping has wrong contents\n", s);
+    exit(1);
+  }
+  p[0] = 'x';
+  // write() from a mapped page no one has touched yet.
+  if(write(fd, p + 2*PGSIZE, 1) != 1){
+    printf("%s: write from mapping failed\n", s);
+    exit(1);
+  }
+  if(munmap(p, 3*PGSIZE) < 0){
+    printf("%s: munmap private failed\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  fd = open("mmap", O_RDWR);
+  if(read(fd, buf, 1) != 1 || buf[0] != 'a'){
+    printf("%s: private write reached the file\n", s);
+    exit(1);
+  }
+  q = mmap(0, PGSIZE, PROT_READ|PROT_WRITE, MAP_SHARED, fd, PGSIZE);
+  if(q == (char*)0xffffffffffffffffL){
+    printf("%s: mmap shared failed\n", s);
+    exit(1);
+  }
+  q[0] = 'y';
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    if(q[0] != 'y')
+      exit(1);
+    q[1] = 'z';
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0 || q[1] != 'z'){
+    printf("%s: shared mapping not shared with child\n", s);
+    exit(1);
+  }
+  if(munmap(q, PGSIZE) < 0){
+    printf("%s: munmap shared failed\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  fd = open("mmap", O_RDONLY);
+  if(read(fd, buf, PGSIZE+2) != PGSIZE+2 || buf[PGSIZE] != 'y' || buf[PGSIZE+1] != 'z'){
+    printf("%s: shared write did not reach the file\n", s);
+    exit(1);
+  }
+  if(mmap(0, PGSIZE, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0) != (char*)0xffffffffffffffffL){
+    printf("%s: writable shared mapping of read-only file\n", s);
+    exit(1);
+  }
+  close(fd);
+  unlink("mmap");
+}
+
+// read() a whole page of a file into a MAP_SHARED page that a
+// forked child shares; the page must stay shared, not be swapped
+// for the file's cached page.
+void
+mmapread(char *s)
+{
+  char *q;
+  int fd, src, pid, xstatus;
+
+  src = open("mmapsrc", O_CREATE|O_RDWR);
+  fd = open("mmapdst", O_CREATE|O_RDWR);
+  if(src < 0 || fd < 0){
+    printf("%s: create failed\n", s);
+    exit(1);
+  }
+  memset(buf, 'r', PGSIZE);
+  if(write(src, buf, PGSIZE) != PGSIZE){
+    printf("%s: write failed\n", s);
+    exit(1);
+  }
+  memset(buf, 'a', PGSIZE);
+  if(write(fd, buf, PGSIZE) != PGSIZE){
+    printf("%s: write failed\n", s);
+    exit(1);
+  }
+  q = mmap(0, PGSIZE, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+  if(q == (char*)0xffffffffffffffffL){
+    printf("%s: mmap shared failed\n", s);
+    exit(1);
+  }
+  q[0] = 'a';
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    close(src);
+    src = open("mmapsrc", O_RDONLY);
+    if(read(src, q, PGSIZE) != PGSIZE)
+      exit(1);
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0){
+    printf("%s: read into shared mapping failed\n", s);
+    exit(1);
+  }
+  if(q[0] != 'r' || q[PGSIZE-1] != 'r'){
+    printf("%s: read into child's shared mapping not seen by parent\n", s);
+    exit(1);
+  }
+  q[1] = 'p';
+  if(munmap(q, PGSIZE) < 0){
+    printf("%s: munmap shared failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  close(src);
+
+  fd = open("mmapdst", O_RDONLY);
+  if(read(fd, buf, PGSIZE) != PGSIZE || buf[0] != 'r' || buf[1] != 'p' ||
+     buf[PGSIZE-1] != 'r'){
+    printf("%s: read into shared mapping did not reach the file\n", s);
+    exit(1);
+  }
+  close(fd);
+  unlink("mmapsrc");
+  unlink("mmapdst");
+}
+
 struct test {
   void (*f)(char *);
   char *s;
@@ -2608,8 +3547,17 @@ struct test {
   {createtest, "createtest"},
   {dirtest, "dirtest"},
   {exectest, "exectest"},
+  {statstest, "stats"},
+  {nicetest, "nicetest"},
+  {nanosleeptest, "nanosleep"},
+  {rusagetest, "rusage"},
   {pipe1, "pipe1"},
+  {pipepages, "pipepages"},
   {killstatus, "killstatus"},
+  {manyprocs, "manyprocs"},
+  {manyfiles, "manyfiles"},
+  {threads, "threads"},
+  {futextest, "futex"},
   {preempt, "preempt"},
   {exitwait, "exitwait"},
   {reparent, "reparent" },
@@ -2618,6 +3566,8 @@ struct test {
   {forkforkfork, "forkforkfork"},
   {reparent2, "reparent2"},
   {mem, "mem"},
+  {mallocsizes, "mallocsizes"},
+  {malloctrim, "malloctrim"},
   {sharedfd, "sharedfd"},
   {fourfiles, "fourfiles"},
   {createdelete, "createdelete"},
@@ -2627,6 +3577,8 @@ struct test {
   {linkunlink, "linkunlink"},
   {subdir, "subdir"},
   {bigwrite, "bigwrite"},
+  {hugewrite, "hugewrite"},
+  {vectorio, "vectorio"},
   {bigfile, "bigfile"},
   {fourteen, "fourteen"},
   {rmdot, "rmdot"},
@@ -2650,6 +3602,9 @@ struct test {
   {sbrklast, "sbrklast"},
   {sbrk8000, "sbrk8000"},
   {badarg, "badarg" },
+  {pagecache, "pagecache" },
+  {mmaptest, "mmap" },
+  {mmapread, "mmapread" },
 
   { 0, 0},
 };
@@ -36,3 +36,17 @@ entry("getpid");
 entry("sbrk");
 entry("sleep");
 entry("uptime");
+entry("mmap");
+entry("munmap");
+entry("readv");
+entry("writev");
+entry("pread");
+entry("pwrite");
+entry("nice");
+entry("clock_gettime");
+entry("nanosleep");
+entry("clone");
+entry("join");
+entry("futexwait");
+entry("futexwake");
+entry("getrusage");
@@ -0,0 +1,51 @@
+//
+// bigwrite-style file write throughput benchmark.
+// writebench [rounds]
+// writes a file of nearly MAXFILE bytes with write()s of
+// several sizes, and reports how long each size took.
+//
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+#include "kernel/fs.h"
+#include "kernel/fcntl.h"
+
+#define TOTAL (256*1024)
+
+char buf[TOTAL];
+
+int
+main(int argc, char *argv[])
+{
+  int sizes[] = { 512, BSIZE, 4*BSIZE, 16*BSIZE, 64*BSIZE, TOTAL };
+  int rounds = 4;
+  int i, r, n, fd, t0, t1;
+
+  if(argc > 1)
+    rounds = atoi(argv[1]);
+  memset(buf, 'w', sizeof(buf));
+
+  for(i = 0; i < sizeof(sizes)/sizeof(sizes[0]); i++){
+    t0 = uptime();
+    for(r = 0; r < rounds; r++){
+      fd = open("writebench.tmp", O_CREATE|O_TRUNC|O_WRONLY);
+      if(fd < 0){
+        fprintf(2, "writebench: cannot create\n");
+        exit(1);
+      }
+      for(n = 0; n < TOTAL; n += sizes[i]){
+        if(write(fd, buf + n, sizes[i]) != sizes[i]){
+          fprintf(2, "writebench: write(%d) failed\n", sizes[i]);
+          exit(1);
+        }
+      }
+      close(fd);
+    }
+    t1 = uptime();
+    printf("writebench: %d rounds of %d KB in %d-byte writes: %d ticks\n",
+           rounds, TOTAL/1024, sizes[i], t1 - t0);
+  }
+  unlink("writebench.tmp");
+  exit(0);
+}